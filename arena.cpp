@@ -0,0 +1,242 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+#ifdef NVLinux
+#include <sys/mman.h>
+#endif
+
+
+//  The working memory for a run (the per point arrays, the bin grid, and the candidate and neighbor lists) is carved out
+//  of a few big blocks instead of coming from malloc one array at a time.  Nothing is freed on its own.  filter_area takes a
+//  mark after the arrays that last the whole run and releases back to it after each band, so the next band reuses the same
+//  memory (already faulted in), and everything goes away at once at the end.  On Linux the blocks are mapped directly and
+//  asked for huge pages, which cuts down on page faults and TLB misses when the arrays get big.  The lists that grow as
+//  they're filled (the per task lists and the waveform pool) still use realloc.
+
+#define HWF_ARENA_ALIGN     64
+#define HWF_HUGE_PAGE_SIZE  2097152
+
+
+/*  Get a new block of at least size bytes (NVFalse if we couldn't).  */
+
+static uint8_t new_block (ARENA *arena, int64_t size)
+{
+  if (arena->block_count == HWF_ARENA_BLOCKS) return (NVFalse);
+
+  ARENA_BLOCK *block = &arena->block[arena->block_count];
+
+  size = qMax (size, (int64_t) HWF_ARENA_BLOCK);
+
+
+  //  Each block is at least as big as the last one so a run that keeps growing doesn't need many of them.
+
+  if (arena->block_count) size = qMax (size, arena->block[arena->block_count - 1].size);
+
+  size = (size + HWF_HUGE_PAGE_SIZE - 1) / HWF_HUGE_PAGE_SIZE * HWF_HUGE_PAGE_SIZE;
+
+  block->base = NULL;
+  block->size = size;
+  block->used = 0;
+  block->mapped = NVFalse;
+
+#ifdef NVLinux
+
+  void *base = MAP_FAILED;
+
+
+  //  Explicit huge pages have to have been set aside by the system administrator (vm.nr_hugepages).  If there aren't enough
+  //  we just fall back to transparent huge pages.
+
+#ifdef MAP_HUGETLB
+
+  if (arena->huge_pages == 2) base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+#endif
+
+  if (base == MAP_FAILED)
+    {
+      base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+#ifdef MADV_HUGEPAGE
+
+      if (base != MAP_FAILED && arena->huge_pages) madvise (base, size, MADV_HUGEPAGE);
+
+#endif
+    }
+
+  if (base != MAP_FAILED)
+    {
+      block->base = (uint8_t *) base;
+      block->mapped = NVTrue;
+    }
+
+#endif
+
+  if (block->base == NULL)
+    {
+      block->base = (uint8_t *) malloc (size);
+      if (block->base == NULL) return (NVFalse);
+    }
+
+  arena->block_count++;
+
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        arena_init                                          *
+*                                                                           *
+*   Purpose:            Set up an empty arena.  No memory is allocated      *
+*                       until the first arena_alloc.                        *
+*                                                                           *
+*   Arguments:          arena          - the arena                          *
+*                       huge_pages     - 0 for normal pages, 1 for          *
+*                                        transparent huge pages, 2 for      *
+*                                        explicit huge pages (falls back to *
+*                                        1 if there aren't any)             *
+*                                                                           *
+*   Return Value:       None                                                *
+*                                                                           *
+\***************************************************************************/
+
+void arena_init (ARENA *arena, int32_t huge_pages)
+{
+  arena->block_count = 0;
+  arena->current = 0;
+  arena->huge_pages = huge_pages;
+  arena->peak = 0;
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        arena_alloc                                         *
+*                                                                           *
+*   Purpose:            Carve bytes out of an arena (aligned to a cache     *
+*                       line).  The memory isn't zeroed unless zero is set. *
+*                       It can't be freed on its own, see arena_release.    *
+*                                                                           *
+*   Arguments:          arena          - the arena                          *
+*                       bytes          - number of bytes                    *
+*                       zero           - set to zero the memory             *
+*                                                                           *
+*   Return Value:       void *         - the memory or NULL                 *
+*                                                                           *
+\***************************************************************************/
+
+void *arena_alloc (ARENA *arena, int64_t bytes, uint8_t zero)
+{
+  bytes = qMax ((int64_t) HWF_ARENA_ALIGN, (bytes + HWF_ARENA_ALIGN - 1) / HWF_ARENA_ALIGN * HWF_ARENA_ALIGN);
+
+
+  //  Move on to the next block if it doesn't fit in this one (the blocks after the current one are empty).
+
+  while (arena->current < arena->block_count && arena->block[arena->current].used + bytes > arena->block[arena->current].size)
+    {
+      arena->current++;
+      if (arena->current < arena->block_count) arena->block[arena->current].used = 0;
+    }
+
+  if (arena->current == arena->block_count && !new_block (arena, bytes))
+    {
+      arena->current = qMax (0, arena->block_count - 1);
+      return (NULL);
+    }
+
+  ARENA_BLOCK *block = &arena->block[arena->current];
+
+  void *ptr = block->base + block->used;
+
+  block->used += bytes;
+
+
+  int64_t in_use = 0;
+
+  for (int32_t i = 0 ; i < arena->current ; i++) in_use += arena->block[i].size;
+
+  arena->peak = qMax (arena->peak, in_use + block->used);
+
+  if (zero) memset (ptr, 0, bytes);
+
+
+  return (ptr);
+}
+
+
+
+/*  Remember where the arena is so that everything allocated after this can be let go of at once.  */
+
+ARENA_MARK arena_mark (ARENA *arena)
+{
+  ARENA_MARK mark;
+
+  mark.block = arena->current;
+  mark.used = (arena->current < arena->block_count) ? arena->block[arena->current].used : 0;
+
+  return (mark);
+}
+
+
+
+/*  Let go of everything allocated since the mark (the blocks are kept for reuse).  */
+
+void arena_release (ARENA *arena, ARENA_MARK mark)
+{
+  for (int32_t i = mark.block + 1 ; i < arena->block_count ; i++) arena->block[i].used = 0;
+
+  arena->current = mark.block;
+
+  if (mark.block < arena->block_count) arena->block[mark.block].used = mark.used;
+}
+
+
+
+/*  Give all of the arena's memory back.  */
+
+void arena_free (ARENA *arena)
+{
+  for (int32_t i = 0 ; i < arena->block_count ; i++)
+    {
+#ifdef NVLinux
+
+      if (arena->block[i].mapped)
+        {
+          munmap (arena->block[i].base, arena->block[i].size);
+          continue;
+        }
+
+#endif
+
+      free (arena->block[i].base);
+    }
+
+  arena->block_count = 0;
+  arena->current = 0;
+}
@@ -0,0 +1,426 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+typedef struct
+{
+  uint64_t    key;
+  int32_t     row;
+  int32_t     col;
+  int32_t     line;
+  int32_t     ndx;
+} BIN_KEY;
+
+
+/*  Spread the 32 bits of a value out to the even bits of a 64 bit value.  */
+
+static uint64_t spread_bits (uint32_t value)
+{
+  uint64_t x = value;
+
+  x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  x = (x | (x << 2)) & 0x3333333333333333ULL;
+  x = (x | (x << 1)) & 0x5555555555555555ULL;
+
+  return (x);
+}
+
+
+/*  Interleave the bits of the row and column to get the Morton (Z order) code of a bin.  */
+
+static uint64_t morton_code (int32_t row, int32_t col)
+{
+  return (spread_bits ((uint32_t) col) | (spread_bits ((uint32_t) row) << 1));
+}
+
+
+/*  Sort on Morton code, then line, then point index (so that the points of each line in a bin stay in point order).  */
+
+static int32_t compare_bin_keys (const void *a, const void *b)
+{
+  BIN_KEY *ka = (BIN_KEY *) (a);
+  BIN_KEY *kb = (BIN_KEY *) (b);
+
+  if (ka->key != kb->key) return (ka->key < kb->key ? -1 : 1);
+  if (ka->line != kb->line) return (ka->line < kb->line ? -1 : 1);
+  if (ka->ndx != kb->ndx) return (ka->ndx < kb->ndx ? -1 : 1);
+
+  return (0);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        find_bin                                            *
+*                                                                           *
+*   Purpose:            Binary search for an occupied cell.                 *
+*                                                                           *
+*   Arguments:          grid           - the bin grid                       *
+*                       row            - cell row                           *
+*                       col            - cell column                        *
+*                                                                           *
+*   Return Value:       int32_t        - index of the cell in grid->bin or  *
+*                                        -1 if the cell is empty            *
+*                                                                           *
+\***************************************************************************/
+
+int32_t find_bin (BIN_GRID *grid, int32_t row, int32_t col)
+{
+  if (row < 0 || col < 0) return (-1);
+
+  uint64_t key = morton_code (row, col);
+  int32_t low = 0, high = grid->bin_count - 1;
+
+  while (low <= high)
+    {
+      int32_t mid = low + (high - low) / 2;
+
+      if (grid->bin[mid].key == key) return (mid);
+
+      if (grid->bin[mid].key < key)
+        {
+          low = mid + 1;
+        }
+      else
+        {
+          high = mid - 1;
+        }
+    }
+
+  return (-1);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        build_bin_grid                                      *
+*                                                                           *
+*   Purpose:            Bin the HOF points for the Hockey Puck of           *
+*                       Confidence (TM) proximity search.  Only occupied    *
+*                       bins are stored so memory and the time spent        *
+*                       walking the bins depend on the number of points,    *
+*                       not on the size of the edit area.  The occupied     *
+*                       bins are in Morton order.  The points in            *
+*                       each bin are grouped by line.  The fields that the  *
+*                       proximity passes need are copied into columns in    *
+*                       the same order.  Each search bin is split into      *
+*                       split by split cells and the cells are what is      *
+*                       actually stored (split 1 is the plain search bin).  *
+*                       Each cell also records the line of its usable       *
+*                       points if they're all from one line.                *
+*                       The grid is carved out of misc->arena so there's    *
+*                       nothing to free (it goes when the band's arena      *
+*                       memory is released in filter_area).                 *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       wave_data      - the per point data                 *
+*                       count          - number of entries in wave_data     *
+*                       search_bin_size - search bin size in meters         *
+*                       split          - cells per search bin in X and Y    *
+*                       grid           - the bin grid to build              *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on memory error            *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t build_bin_grid (MISC *misc, WAVE_DATA *wave_data, int32_t count, double search_bin_size, int32_t split, BIN_GRID *grid)
+{
+  split = qMax (1, qMin (HWF_MAX_SPLIT, split));
+
+  double bin_size = search_bin_size / (double) split;
+
+  grid->search_bin_size = search_bin_size;
+  grid->split = split;
+  grid->bin_size = bin_size;
+  grid->reach = split;
+  grid->slack = (float) (search_bin_size * HWF_MASK_SLACK);
+  grid->bin_count = 0;
+  grid->bin = NULL;
+  grid->line_count = 0;
+  grid->line = NULL;
+  grid->count = 0;
+  grid->data = NULL;
+  grid->mx = grid->my = NULL;
+  grid->lx = grid->ly = NULL;
+  grid->z = grid->herr = grid->verr = NULL;
+  grid->line_num = NULL;
+  grid->flags = NULL;
+
+
+  BIN_KEY *key = (BIN_KEY *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (BIN_KEY), NVFalse);
+  if (key == NULL)
+    {
+      perror ("Allocating bin keys in bin_grid.cpp");
+      return (NVFalse);
+    }
+
+
+  //  Only HOF points have positions (and waveforms).
+
+  int32_t key_count = 0;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      if (misc->data[wave_data[i].ndx].type != PFM_CHARTS_HOF_DATA) continue;
+
+      //  The cell is worked out inside the search bin so that a cell never straddles two search bins (the search bins decide
+      //  which points get looked at).
+
+      int32_t crow = (int32_t) (wave_data[i].my / search_bin_size);
+      int32_t ccol = (int32_t) (wave_data[i].mx / search_bin_size);
+      int32_t j = (int32_t) ((wave_data[i].my - (double) crow * search_bin_size) / bin_size);
+      int32_t k = (int32_t) ((wave_data[i].mx - (double) ccol * search_bin_size) / bin_size);
+
+      key[key_count].row = crow * split + qMax (0, qMin (split - 1, j));
+      key[key_count].col = ccol * split + qMax (0, qMin (split - 1, k));
+      key[key_count].key = morton_code (key[key_count].row, key[key_count].col);
+      key[key_count].line = misc->data[wave_data[i].ndx].line;
+      key[key_count].ndx = i;
+      key_count++;
+    }
+
+  count = key_count;
+
+  qsort (key, count, sizeof (BIN_KEY), compare_bin_keys);
+
+
+  //  Count the occupied bins and the line groups so we only have to allocate once.
+
+  int32_t bin_count = 0, line_count = 0;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      if (!i || key[i].key != key[i - 1].key)
+        {
+          bin_count++;
+          line_count++;
+        }
+      else if (key[i].line != key[i - 1].line)
+        {
+          line_count++;
+        }
+    }
+
+
+  grid->data = (int32_t *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (int32_t), NVFalse);
+  grid->bin = (BIN_DATA *) arena_alloc (&misc->arena, qMax (bin_count, 1) * sizeof (BIN_DATA), NVFalse);
+  grid->line = (BIN_LINE *) arena_alloc (&misc->arena, qMax (line_count, 1) * sizeof (BIN_LINE), NVFalse);
+  grid->mx = (double *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (double), NVFalse);
+  grid->my = (double *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (double), NVFalse);
+  grid->lx = (float *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (float), NVFalse);
+  grid->ly = (float *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (float), NVFalse);
+  grid->z = (float *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (float), NVFalse);
+  grid->herr = (float *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (float), NVFalse);
+  grid->verr = (float *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (float), NVFalse);
+  grid->line_num = (int32_t *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (int32_t), NVFalse);
+  grid->flags = (uint8_t *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (uint8_t), NVFalse);
+  if (grid->data == NULL || grid->bin == NULL || grid->line == NULL || grid->mx == NULL || grid->my == NULL || grid->lx == NULL ||
+      grid->ly == NULL || grid->z == NULL || grid->herr == NULL || grid->verr == NULL || grid->line_num == NULL || grid->flags == NULL)
+    {
+      perror ("Allocating bin grid in bin_grid.cpp");
+      return (NVFalse);
+    }
+
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      uint8_t new_bin = (!i || key[i].key != key[i - 1].key);
+
+      if (new_bin)
+        {
+          BIN_DATA *bin = &grid->bin[grid->bin_count];
+
+          bin->key = key[i].key;
+          bin->row = key[i].row;
+          bin->col = key[i].col;
+          bin->crow = key[i].row / split;
+          bin->ccol = key[i].col / split;
+          bin->herr_max = 0.0;
+          bin->start = i;
+          bin->count = 0;
+          bin->line_start = grid->line_count;
+          bin->line_count = 0;
+          bin->usable_line = HWF_NO_LINE;
+          grid->bin_count++;
+        }
+
+      if (new_bin || key[i].line != key[i - 1].line)
+        {
+          BIN_LINE *line = &grid->line[grid->line_count];
+
+          line->line = key[i].line;
+          line->start = i;
+          line->count = 0;
+          grid->line_count++;
+          grid->bin[grid->bin_count - 1].line_count++;
+        }
+
+      int32_t k = key[i].ndx;
+      int32_t ndx = wave_data[k].ndx;
+
+      grid->data[i] = k;
+      grid->mx[i] = wave_data[k].mx;
+      grid->my[i] = wave_data[k].my;
+      grid->lx[i] = (float) (wave_data[k].mx - (double) key[i].col * bin_size);
+      grid->ly[i] = (float) (wave_data[k].my - (double) key[i].row * bin_size);
+      grid->z[i] = misc->data[ndx].z;
+      grid->herr[i] = misc->data[ndx].herr;
+      grid->verr[i] = misc->data[ndx].verr;
+      grid->line_num[i] = misc->data[ndx].line;
+
+      grid->flags[i] = 0;
+      if (!(misc->data[ndx].val & PFM_INVAL) && !wave_data[k].killed) grid->flags[i] |= HWF_USABLE;
+      if (wave_data[k].check) grid->flags[i] |= HWF_CHECK;
+      if (wave_data[k].killed) grid->flags[i] |= HWF_KILLED;
+
+      if (grid->flags[i] & HWF_USABLE)
+        {
+          BIN_DATA *bin = &grid->bin[grid->bin_count - 1];
+
+          bin->usable_line = (bin->usable_line == HWF_NO_LINE || bin->usable_line == grid->line_num[i]) ? grid->line_num[i] : HWF_MIXED_LINES;
+        }
+
+      grid->bin[grid->bin_count - 1].herr_max = qMax (grid->bin[grid->bin_count - 1].herr_max, grid->herr[i]);
+      grid->bin[grid->bin_count - 1].count++;
+      grid->line[grid->line_count - 1].count++;
+    }
+
+  grid->count = count;
+
+
+
+  //  Work out how many cells away from a cell a neighbor of one of its points can be.  A neighbor is within the search radius
+  //  plus both horizontal errors so we use the largest horizontal error in the grid (and pad it the same way as neighbor_mask).
+  //  Points sit on the edges of their cells so we add one cell for that and one more for rounding in the cell numbers.
+
+  float herr_max = 0.0;
+
+  for (int32_t i = 0 ; i < grid->bin_count ; i++) herr_max = qMax (herr_max, grid->bin[i].herr_max);
+
+  double reach = (misc->abe_share->filterShare.search_radius + 2.0 * herr_max) * HWF_MASK_SCALE + grid->slack;
+
+  grid->reach = qMin (3 * split, (int32_t) (reach / bin_size) + 2);
+
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        stencil_cells                                       *
+*                                                                           *
+*   Purpose:            Find the occupied cells that can hold a neighbor    *
+*                       of a point in a cell.  These are the cells that are *
+*                       in the 9 search bin block around the cell's search  *
+*                       bin and within grid->reach cells of the cell.  They *
+*                       are listed in row then column order.                *
+*                                                                           *
+*   Arguments:          grid           - the bin grid                       *
+*                       b              - index of the cell in grid->bin     *
+*                       stencil        - returned cell indices (room for    *
+*                                        HWF_MAX_STENCIL)                   *
+*                                                                           *
+*   Return Value:       int32_t        - number of cells in stencil         *
+*                                                                           *
+\***************************************************************************/
+
+int32_t stencil_cells (BIN_GRID *grid, int32_t b, int32_t *stencil)
+{
+  BIN_DATA *bin = &grid->bin[b];
+  int32_t count = 0;
+
+  int32_t start_row = qMax ((bin->crow - 1) * grid->split, bin->row - grid->reach);
+  int32_t end_row = qMin ((bin->crow + 2) * grid->split - 1, bin->row + grid->reach);
+  int32_t start_col = qMax ((bin->ccol - 1) * grid->split, bin->col - grid->reach);
+  int32_t end_col = qMin ((bin->ccol + 2) * grid->split - 1, bin->col + grid->reach);
+
+  for (int32_t m = start_row ; m <= end_row ; m++)
+    {
+      for (int32_t n = start_col ; n <= end_col ; n++)
+        {
+          int32_t ndx = (m == bin->row && n == bin->col) ? b : find_bin (grid, m, n);
+
+          if (ndx >= 0)
+            {
+              stencil[count] = ndx;
+              count++;
+            }
+        }
+    }
+
+  return (count);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        cell_in_reach                                       *
+*                                                                           *
+*   Purpose:            Check whether any point in a cell could be within   *
+*                       the search distance of a point.  The distance is    *
+*                       padded the same way as in neighbor_mask so this     *
+*                       never drops a cell that holds a neighbor.           *
+*                                                                           *
+*   Arguments:          grid           - the bin grid                       *
+*                       cell           - the cell                           *
+*                       mx             - X position of the point (meters)   *
+*                       my             - Y position of the point (meters)   *
+*                       base           - search radius plus the point's     *
+*                                        horizontal error                   *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse if the cell can be skipped *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t cell_in_reach (BIN_GRID *grid, BIN_DATA *cell, double mx, double my, double base)
+{
+  //  With a single cell per search bin the 9 bin block is already as small as it gets.
+
+  if (grid->split == 1) return (NVTrue);
+
+
+  //  The last cell in a search bin runs to the end of the search bin (see build_bin_grid).
+
+  int32_t j = cell->row - cell->crow * grid->split;
+  int32_t k = cell->col - cell->ccol * grid->split;
+
+  double y0 = (double) cell->crow * grid->search_bin_size + (double) j * grid->bin_size;
+  double x0 = (double) cell->ccol * grid->search_bin_size + (double) k * grid->bin_size;
+  double y1 = (j == grid->split - 1) ? (double) (cell->crow + 1) * grid->search_bin_size : y0 + grid->bin_size;
+  double x1 = (k == grid->split - 1) ? (double) (cell->ccol + 1) * grid->search_bin_size : x0 + grid->bin_size;
+
+  double dx = qMax (0.0, qMax (x0 - mx, mx - x1));
+  double dy = qMax (0.0, qMax (y0 - my, my - y1));
+  double reach = (base + cell->herr_max) * HWF_MASK_SCALE + grid->slack;
+
+  return (dx * dx + dy * dy <= reach * reach);
+}
@@ -0,0 +1,223 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  Capture file layout (native byte order, it's meant to be replayed by the same build of hofWaveFilter):
+//
+//      CAPTURE_HEADER
+//      CAPTURE_HEADER.pfm_count PFM_OPEN_ARGS
+//      CAPTURE_HEADER.point_cloud_count POINT_CLOUD
+//
+//  Only the parts of ABE_SHARE that the filter looks at are saved.  The PFM, HOF, and INH files aren't in the capture so
+//  they have to be where they were (or at the same paths) when the capture is replayed.
+
+#define HWF_CAPTURE_VERSION   1
+
+typedef struct
+{
+  char         magic[4];                 //  "HWFC"
+  int32_t      version;                  //  HWF_CAPTURE_VERSION
+  int32_t      open_args_size;           //  sizeof (PFM_OPEN_ARGS)
+  int32_t      point_size;               //  sizeof (POINT_CLOUD)
+  int32_t      pfm_count;
+  int32_t      point_cloud_count;
+  NV_F64_XYMBR edit_area;
+  FILTER_SHARE filterShare;
+} CAPTURE_HEADER;
+
+
+//  The stand in shared memory made by replay_session.  They have to stay around until we're done (the segments go away
+//  when the last one detaches).
+
+static QSharedMemory *replay_abe = NULL, *replay_data = NULL;
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        capture_session                                     *
+*                                                                           *
+*   Purpose:            Save what the filter uses from ABE_SHARE and the    *
+*                       point cloud to a file (--capture) so that the run   *
+*                       can be repeated later without pfmEdit(3D) with      *
+*                       --replay.  This has to be called before the filter  *
+*                       changes any of the points.                          *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       file           - capture file name                  *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t capture_session (MISC *misc, char *file)
+{
+  FILE *fp;
+  CAPTURE_HEADER header;
+  uint8_t status = NVTrue;
+
+
+  if ((fp = fopen (file, "wb")) == NULL)
+    {
+      perror (file);
+      return (NVFalse);
+    }
+
+  memset (&header, 0, sizeof (CAPTURE_HEADER));
+
+  memcpy (header.magic, "HWFC", 4);
+  header.version = HWF_CAPTURE_VERSION;
+  header.open_args_size = sizeof (PFM_OPEN_ARGS);
+  header.point_size = sizeof (POINT_CLOUD);
+  header.pfm_count = misc->abe_share->pfm_count;
+  header.point_cloud_count = misc->abe_share->point_cloud_count;
+  header.edit_area = misc->abe_share->edit_area;
+  header.filterShare = misc->abe_share->filterShare;
+
+  if (fwrite (&header, sizeof (CAPTURE_HEADER), 1, fp) != 1 ||
+      fwrite (misc->abe_share->open_args, sizeof (PFM_OPEN_ARGS), header.pfm_count, fp) != (size_t) header.pfm_count ||
+      fwrite (misc->data, sizeof (POINT_CLOUD), header.point_cloud_count, fp) != (size_t) header.point_cloud_count)
+    {
+      perror (file);
+      status = NVFalse;
+    }
+
+  fclose (fp);
+
+
+  return (status);
+}
+
+
+
+/*  Let go of the stand in shared memory (registered with atexit so that it happens however we leave).  */
+
+static void replay_cleanup ()
+{
+  if (replay_data)
+    {
+      replay_data->detach ();
+      delete replay_data;
+      replay_data = NULL;
+    }
+
+  if (replay_abe)
+    {
+      replay_abe->detach ();
+      delete replay_abe;
+      replay_abe = NULL;
+    }
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        replay_session                                      *
+*                                                                           *
+*   Purpose:            Read a capture file written by capture_session and  *
+*                       make stand in ABE and point cloud shared memory     *
+*                       from it (--replay).  The ABE key is our own process *
+*                       ID so the rest of the program attaches to them the  *
+*                       same way it would to pfmView's and pfmEdit(3D)'s.   *
+*                       They're removed when we exit.                       *
+*                                                                           *
+*   Arguments:          file           - capture file name                  *
+*                       key            - returned shared memory key         *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t replay_session (char *file, int32_t *key, char *progname)
+{
+  FILE *fp;
+  CAPTURE_HEADER header;
+
+
+  if ((fp = fopen (file, "rb")) == NULL)
+    {
+      perror (file);
+      return (NVFalse);
+    }
+
+  if (fread (&header, sizeof (CAPTURE_HEADER), 1, fp) != 1 || memcmp (header.magic, "HWFC", 4) || header.version != HWF_CAPTURE_VERSION ||
+      header.open_args_size != (int32_t) sizeof (PFM_OPEN_ARGS) || header.point_size != (int32_t) sizeof (POINT_CLOUD) ||
+      header.pfm_count < 1 || header.pfm_count > MAX_ABE_PFMS || header.point_cloud_count < 0)
+    {
+      fprintf (stderr, "%s - %s is not a version %d hofWaveFilter capture file from this build\n", progname, file, HWF_CAPTURE_VERSION);
+      fclose (fp);
+      return (NVFalse);
+    }
+
+
+  *key = (int32_t) getpid ();
+
+  QString skey;
+  skey.sprintf ("%d_abe", *key);
+
+  QString dskey;
+  dskey.sprintf ("%d_abe_pfmEdit", *key);
+
+  replay_abe = new QSharedMemory (skey);
+  replay_data = new QSharedMemory (dskey);
+
+  atexit (replay_cleanup);
+
+  if (!replay_abe->create (sizeof (ABE_SHARE), QSharedMemory::ReadWrite) ||
+      !replay_data->create (qMax (header.point_cloud_count, 1) * sizeof (POINT_CLOUD), QSharedMemory::ReadWrite))
+    {
+      fprintf (stderr, "%s %s %s %d - replay shared memory - %s\n", progname, __FILE__, __FUNCTION__, __LINE__, strerror (errno));
+      fclose (fp);
+      return (NVFalse);
+    }
+
+
+  //  Everything that wasn't captured is zero.
+
+  ABE_SHARE *abe_share = (ABE_SHARE *) replay_abe->data ();
+
+  memset (abe_share, 0, sizeof (ABE_SHARE));
+
+  abe_share->ppid = *key;
+  abe_share->pfm_count = header.pfm_count;
+  abe_share->point_cloud_count = header.point_cloud_count;
+  abe_share->edit_area = header.edit_area;
+  abe_share->filterShare = header.filterShare;
+
+  if (fread (abe_share->open_args, sizeof (PFM_OPEN_ARGS), header.pfm_count, fp) != (size_t) header.pfm_count ||
+      fread (replay_data->data (), sizeof (POINT_CLOUD), header.point_cloud_count, fp) != (size_t) header.point_cloud_count)
+    {
+      fprintf (stderr, "%s - truncated capture file %s\n", progname, file);
+      fclose (fp);
+      return (NVFalse);
+    }
+
+  fclose (fp);
+
+
+  return (NVTrue);
+}
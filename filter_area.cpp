@@ -0,0 +1,487 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  Bin row of each HOF point for splitting the area into bands (--memory_budget).
+
+#define HWF_MAX_ROW   0x3fffffff
+
+typedef struct
+{
+  int32_t     row;
+  int32_t     ndx;
+} ROW_KEY;
+
+
+/*  This is the row/point sort function for the band row keys.  */
+
+static int32_t compare_row_keys (const void *a, const void *b)
+{
+    ROW_KEY *ra = (ROW_KEY *) (a);
+    ROW_KEY *rb = (ROW_KEY *) (b);
+
+    if (ra->row != rb->row) return (ra->row < rb->row ? -1 : 1);
+
+    return (ra->ndx < rb->ndx ? -1 : (ra->ndx > rb->ndx ? 1 : 0));
+}
+
+
+/*  This is the point sort function for the per point data in a band.  */
+
+static int32_t compare_wave_data (const void *a, const void *b)
+{
+    WAVE_DATA *wa = (WAVE_DATA *) (a);
+    WAVE_DATA *wb = (WAVE_DATA *) (b);
+
+    return (wa->ndx < wb->ndx ? -1 : (wa->ndx > wb->ndx ? 1 : 0));
+}
+
+
+/*  Binary search for the first row key at or above row.  */
+
+static int32_t find_row (ROW_KEY *row_key, int32_t count, int32_t row)
+{
+  int32_t low = 0, high = count;
+
+  while (low < high)
+    {
+      int32_t mid = low + (high - low) / 2;
+
+      if (row_key[mid].row < row)
+        {
+          low = mid + 1;
+        }
+      else
+        {
+          high = mid;
+        }
+    }
+
+  return (low);
+}
+
+
+
+/*  Copy the kills so far into the point cloud and tell pfmEdit(3D) that there are (partial) results to look at.  The point
+    cloud isn't locked while we work when we're publishing results (see hofWaveFilter.cpp) so we lock it while we write to it.  */
+
+static void publish_kills (MISC *misc)
+{
+  misc->dataShare->lock ();
+
+  for (int32_t i = 0 ; i < misc->abe_share->point_cloud_count ; i++) if (HWF_BIT_TEST (misc->kill_bits, i)) misc->data[i].exflag = NVTrue;
+
+  misc->dataShare->unlock ();
+
+
+  misc->abeShare->lock ();
+
+  misc->abe_share->modcode = PFM_CHARTS_HOF_DATA | HWF_MODCODE_PARTIAL;
+
+  misc->abeShare->unlock ();
+}
+
+
+
+/*  Say how much of the area was done when the time budget ran out.  Everything below the row of row_key[next] was done.  */
+
+static void report_coverage (MISC *misc, ROW_KEY *row_key, int32_t row_key_count, int32_t next, char *progname)
+{
+  if (next >= row_key_count)
+    {
+      fprintf (stderr, "%s - time budget used up after %d bands, all of the rows were started\n", progname, misc->bands);
+      return;
+    }
+
+  double min_y = misc->data[row_key[next].ndx].y;
+
+  for (int32_t k = next ; k < row_key_count && row_key[k].row == row_key[next].row ; k++) min_y = qMin (min_y, misc->data[row_key[k].ndx].y);
+
+  fprintf (stderr, "%s - time budget used up after %d bands, the points below latitude %.9f were filtered%s\n", progname,
+           misc->bands, min_y, misc->priority ? " (plus a preview of the priority area)" : "");
+}
+
+
+
+/*  Set once the --time_budget is used up.  This is checked before each band here and between the stages of a band in
+    filter_band.  */
+
+uint8_t out_of_time (MISC *misc)
+{
+  return (misc->time_budget && misc->run_clock.elapsed () >= misc->time_budget);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        filter_area                                         *
+*                                                                           *
+*   Purpose:            Run the return filters, the proximity search, and   *
+*                       the waveform check on every point in the point      *
+*                       cloud, setting exflag for the points that should    *
+*                       be killed.  If it fails some of the points may      *
+*                       already have been flagged.  With --time_budget or   *
+*                       --priority_area the kills are published after each  *
+*                       band and misc->partial is set if the time budget    *
+*                       ran out before the whole area was done (a band can  *
+*                       be cut short, only its decided points are flagged). *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t filter_area (MISC *misc, char *progname)
+{
+  //  Normally we do the whole area at once.  If a memory budget was given we split the area into bands of proximity search bin
+  //  rows instead and do them from the bottom up.  Each band also gets the two rows of bins on either side of it so that the
+  //  proximity search and the waveform check see exactly the same neighbors they would if we did the whole area at once (see
+  //  filter_band.cpp).  The HOF points are sorted by bin row so that we can pick each band out of the list.  We save what we
+  //  read for each point so that points in the extra rows only get read once.  The per point arrays and everything each band
+  //  needs come out of misc->arena (see arena.cpp), and the band's memory is handed back before the next band starts.
+  //
+  //  With --time_budget or --priority_area we always work in bands and copy the kills into the point cloud after each one
+  //  so that pfmEdit(3D) can show them before we're done.  Once the time budget is used up we stop, in the middle of a band
+  //  if need be (filter_band only ever flags a point once its fate is certain so what's been flagged is still right).  With
+  //  a time budget the bands are also kept small enough to fit in the time left at the rate of the bands so far.  The
+  //  rows of the priority area are done first as a preview band.  The waveform check has to be done from the bottom up to
+  //  come out exactly right (a killed point doesn't support the points after it), and in the preview the unchecked points
+  //  below the priority area are still counted as support, so the preview only kills points that the full run would also
+  //  kill.  Its waveform check kills are published and then taken back out of kill_bits, and its rows are done again in
+  //  order with the rest of the bands, so a run that isn't cut short comes out exactly the same as one done all at once.
+
+  QElapsedTimer timer;
+  WAVE_DATA *wave_data;
+  double bin_size = misc->abe_share->filterShare.search_radius * 2.0;
+  uint8_t status = NVTrue;
+  POINT_STATE *state = NULL;
+  ROW_KEY *row_key = NULL;
+  int32_t row_key_count = 0, next = 0, band = 0;
+  uint8_t banded = (misc->memory_budget || misc->progressive);
+  uint8_t preview = NVFalse;
+  int64_t budget = misc->memory_budget, band_ns = 0, band_points = 0;
+
+
+  misc->run_clock.start ();
+
+  misc->partial = NVFalse;
+
+
+  //  Rough number of bytes used per point in a band.  The waveform pool is sized as if every point in the band had to be
+  //  loaded (it's usually far fewer).  The rest is the bin grid, the bin sort keys, and the neighbor lists.
+
+  int64_t point_bytes = sizeof (WAVE_DATA) + 96 + (misc->compress ? sizeof (WAVEFORM) / 2 : sizeof (WAVEFORM));
+
+
+  //  Points that are killed (or were already killed) are marked in misc->kill_bits while we work and copied to exflag when
+  //  we're done.  That keeps the neighbor checks out of the point cloud.
+
+  arena_init (&misc->arena, misc->huge_pages);
+
+  misc->kill_bits = (uint64_t *) arena_alloc (&misc->arena, HWF_BIT_WORDS (qMax (misc->abe_share->point_cloud_count, 1)) *
+                                              sizeof (uint64_t), NVTrue);
+  if (misc->kill_bits == NULL)
+    {
+      perror ("Allocating kill bits in filter_area.cpp");
+      arena_free (&misc->arena);
+      return (NVFalse);
+    }
+
+  for (int32_t i = 0 ; i < misc->abe_share->point_cloud_count ; i++) if (misc->data[i].exflag) HWF_BIT_SET (misc->kill_bits, i);
+
+  start_prefetch (misc);
+
+  if (banded)
+    {
+      state = (POINT_STATE *) arena_alloc (&misc->arena, qMax (misc->abe_share->point_cloud_count, 1) * sizeof (POINT_STATE),
+                                           NVTrue);
+      row_key = (ROW_KEY *) arena_alloc (&misc->arena, qMax (misc->abe_share->point_cloud_count, 1) * sizeof (ROW_KEY), NVFalse);
+      if (state == NULL || row_key == NULL)
+        {
+          perror ("Allocating band memory in filter_area.cpp");
+          arena_free (&misc->arena);
+          misc->kill_bits = NULL;
+          stop_prefetch (misc);
+          return (NVFalse);
+        }
+
+      for (int32_t i = 0 ; i < misc->abe_share->point_cloud_count ; i++)
+        {
+          if (misc->data[i].type != PFM_CHARTS_HOF_DATA) continue;
+
+          double my;
+          geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->data[i].y, misc->abe_share->edit_area.min_x, &my);
+
+          row_key[row_key_count].row = (int32_t) (my / bin_size);
+          row_key[row_key_count].ndx = i;
+          row_key_count++;
+        }
+
+      qsort (row_key, row_key_count, sizeof (ROW_KEY), compare_row_keys);
+
+
+      //  Without a memory budget we just want enough bands to publish along the way.
+
+      if (!budget) budget = qMax (row_key_count / HWF_PROGRESS_BANDS, 1) * point_bytes;
+    }
+
+
+  //  The bin rows of the priority area (if it has any points).
+
+  int32_t priority_first = 0, priority_last = -1;
+
+  if (misc->priority && row_key_count)
+    {
+      double min_my, max_my;
+      geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->priority_area.min_y, misc->abe_share->edit_area.min_x, &min_my);
+      geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->priority_area.max_y, misc->abe_share->edit_area.min_x, &max_my);
+
+      if (misc->priority_area.min_y < misc->abe_share->edit_area.min_y) min_my = 0.0;
+
+      priority_first = (int32_t) (min_my / bin_size);
+      priority_last = (int32_t) (max_my / bin_size);
+
+      preview = (misc->priority_area.max_y >= misc->abe_share->edit_area.min_y &&
+                 find_row (row_key, row_key_count, priority_last + 1) > find_row (row_key, row_key_count, priority_first));
+    }
+
+
+  //  Everything allocated from the arena after this only lasts for one band.
+
+  ARENA_MARK mark = arena_mark (&misc->arena);
+
+
+  while (NVTrue)
+    {
+      int32_t first_row, last_row, begin = 0, count;
+
+      if (!banded)
+        {
+          if (band) break;
+
+          first_row = -HWF_MAX_ROW;
+          last_row = HWF_MAX_ROW;
+          count = misc->abe_share->point_cloud_count;
+        }
+      else if (preview)
+        {
+          first_row = priority_first;
+          last_row = priority_last;
+          begin = find_row (row_key, row_key_count, first_row - 2);
+          count = find_row (row_key, row_key_count, last_row + 3) - begin;
+        }
+      else
+        {
+          if (next >= row_key_count) break;
+
+
+          //  Out of time.  Everything below the next row has been done.
+
+          if (out_of_time (misc))
+            {
+              misc->partial = NVTrue;
+              report_coverage (misc, row_key, row_key_count, next, progname);
+              break;
+            }
+
+
+          //  With a time budget, keep the band to about as many points as we've been doing in the time that's left.
+
+          int64_t band_budget = budget;
+
+          if (misc->time_budget && band_points)
+            {
+              int64_t left_ns = ((int64_t) misc->time_budget - misc->run_clock.elapsed ()) * 1000000;
+
+              band_budget = qMin (budget, qMax ((int64_t) 1, left_ns * band_points / qMax (band_ns, (int64_t) 1)) * point_bytes);
+            }
+
+
+          //  Add rows to the band until the band plus the rows around it won't fit in the budget (always at least one row).
+
+          first_row = last_row = row_key[next].row;
+          begin = find_row (row_key, row_key_count, first_row - 2);
+
+          while (NVTrue)
+            {
+              int32_t after = find_row (row_key, row_key_count, last_row + 1);
+              if (after >= row_key_count) break;
+
+              int32_t row = row_key[after].row;
+              int32_t end = find_row (row_key, row_key_count, row + 3);
+
+              if ((int64_t) (end - begin) * point_bytes > band_budget) break;
+
+              last_row = row;
+            }
+
+          count = find_row (row_key, row_key_count, last_row + 3) - begin;
+          next = find_row (row_key, row_key_count, last_row + 1);
+        }
+
+
+      wave_data = (WAVE_DATA *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (WAVE_DATA), NVFalse);
+      if (wave_data == NULL)
+        {
+          perror ("Allocating wave_data in filter_area.cpp");
+          status = NVFalse;
+          break;
+        }
+
+
+      //  The band's points have to be in misc->data order (the proximity search uses the order to break ties).
+
+      if (banded)
+        {
+          for (int32_t k = 0 ; k < count ; k++) wave_data[k].ndx = row_key[begin + k].ndx;
+
+          qsort (wave_data, count, sizeof (WAVE_DATA), compare_wave_data);
+        }
+      else
+        {
+          for (int32_t k = 0 ; k < count ; k++) wave_data[k].ndx = k;
+        }
+
+
+      //  Read the HOF records and do the low slope filter on all the data points.
+
+      int64_t band_start = misc->run_clock.nsecsElapsed ();
+
+      timer.start ();
+
+      if (!ingest_points (misc, wave_data, count, state, progname))
+        {
+          status = NVFalse;
+          break;
+        }
+
+      misc->stage_ns[0] += timer.nsecsElapsed ();
+
+
+      //  The time budget ran out while we were reading.  The return filter kills are right so we show those.
+
+      if (misc->partial)
+        {
+          if (misc->progressive) publish_kills (misc);
+
+          report_coverage (misc, row_key, row_key_count, preview ? 0 : find_row (row_key, row_key_count, first_row), progname);
+          arena_release (&misc->arena, mark);
+          break;
+        }
+
+
+      //  Proximity search and waveform check.  The preview's waveform check kills are only published (see above) so we remember
+      //  which of its points were killed before the check.  The preview isn't traced since its rows are done again.
+
+      if (preview)
+        {
+          uint8_t *killed = (uint8_t *) arena_alloc (&misc->arena, qMax (count, 1), NVFalse);
+          if (killed == NULL)
+            {
+              perror ("Allocating preview memory in filter_area.cpp");
+              status = NVFalse;
+              break;
+            }
+
+          for (int32_t k = 0 ; k < count ; k++) killed[k] = HWF_BIT_TEST (misc->kill_bits, wave_data[k].ndx);
+
+          TRACE_RING *trace = misc->trace;
+          misc->trace = NULL;
+
+          status = filter_band (misc, wave_data, count, first_row, last_row, progname);
+
+          misc->trace = trace;
+
+          if (!status) break;
+
+          band_ns += misc->run_clock.nsecsElapsed () - band_start;
+          band_points += count;
+
+          publish_kills (misc);
+
+          for (int32_t k = 0 ; k < count ; k++)
+            {
+              int32_t ndx = wave_data[k].ndx;
+
+              if (!killed[k]) misc->kill_bits[ndx >> 6] &= ~((uint64_t) 1 << (ndx & 63));
+            }
+
+          preview = NVFalse;
+        }
+      else
+        {
+          if (!filter_band (misc, wave_data, count, first_row, last_row, progname))
+            {
+              status = NVFalse;
+              break;
+            }
+
+          band++;
+          misc->bands++;
+
+          band_ns += misc->run_clock.nsecsElapsed () - band_start;
+          band_points += count;
+
+          if (misc->progressive) publish_kills (misc);
+
+
+          //  filter_band stopped part way through the band because the time budget ran out.
+
+          if (misc->partial)
+            {
+              report_coverage (misc, row_key, row_key_count, find_row (row_key, row_key_count, first_row), progname);
+              arena_release (&misc->arena, mark);
+              break;
+            }
+        }
+
+
+      //  Everything the band carved out of the arena (wave_data, the bin grid, the candidate lists) goes back for the next
+      //  band.
+
+      arena_release (&misc->arena, mark);
+    }
+
+
+  stop_prefetch (misc);
+
+
+  //  Flag the killed points in the point cloud (locking it if we aren't holding it for the whole run, see publish_kills).
+
+  if (misc->progressive) misc->dataShare->lock ();
+
+  for (int32_t i = 0 ; i < misc->abe_share->point_cloud_count ; i++) if (HWF_BIT_TEST (misc->kill_bits, i)) misc->data[i].exflag = NVTrue;
+
+  if (misc->progressive) misc->dataShare->unlock ();
+
+  arena_free (&misc->arena);
+  misc->kill_bits = NULL;
+
+
+  return (status);
+}
@@ -0,0 +1,953 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  Number of neighbors (closest first) of each point whose waveforms are read in the first round of the waveform check and the
+//  decisions for the waveform check rounds (see filter_band).
+
+#define HWF_FIRST_NEIGHBORS 2
+
+#define HWF_UNDECIDED       0
+#define HWF_KEEP            1
+#define HWF_KILL            2
+
+
+//  The proximity passes are run as tasks on the worker pool (see run_pool).  A task is a run of points (in bin grid order)
+//  starting in bin.  Most tasks are a run of whole bins but a bin with more points than a task should have (a pier or a
+//  patch of overlap) is split over several tasks.  Each task keeps its own candidates and neighbor lists for the gather pass
+//  so that the threads never write to the same memory.  They're put together in task order when the pass is done.
+
+typedef struct
+{
+  double      dist;                      //  Squared distance from the point
+  int32_t     ndx;                       //  wave_data index of the neighbor
+} NEAR_REC;
+
+
+typedef struct
+{
+  int32_t     bin;                       //  Index of the first bin in grid->bin
+  int32_t     start;                     //  First point
+  int32_t     end;                       //  One past the last point
+  CANDIDATE   *cand;                     //  Candidates found by the gather pass (start is in nbr for this task)
+  int32_t     cand_count;
+  int32_t     cand_size;
+  int32_t     *nbr;                      //  Neighbor lists found by the gather pass
+  int32_t     nbr_count;
+  int32_t     nbr_size;
+  NEAR_REC    *near;                     //  Scratch space for sorting a neighbor list
+  int32_t     near_size;
+  uint8_t     error;                     //  Set if we ran out of memory
+} BAND_TASK;
+
+
+typedef struct
+{
+  MISC        *misc;
+  WAVE_DATA   *wave_data;
+  BIN_GRID    *grid;
+  BAND_TASK   *task;
+  int32_t     first_row;
+  int32_t     last_row;
+} BAND_WORK;
+
+
+//  The isolation pass clears check flags of points that other threads may be looking at so all flag access in that pass goes
+//  through these.  The other flags never change during the pass so a relaxed load is all we need.
+
+static inline uint8_t get_flags (BIN_GRID *grid, int32_t p)
+{
+  return (__atomic_load_n (&grid->flags[p], __ATOMIC_RELAXED));
+}
+
+
+static inline void clear_check (BIN_GRID *grid, int32_t p)
+{
+  __atomic_fetch_and (&grid->flags[p], (uint8_t) ~HWF_CHECK, __ATOMIC_RELAXED);
+}
+
+
+/*  This is the row/column/point sort function for the waveform check candidates.  */
+
+static int32_t compare_candidates (const void *a, const void *b)
+{
+    CANDIDATE *ca = (CANDIDATE *) (a);
+    CANDIDATE *cb = (CANDIDATE *) (b);
+
+    if (ca->row != cb->row) return (ca->row < cb->row ? -1 : 1);
+    if (ca->col != cb->col) return (ca->col < cb->col ? -1 : 1);
+    if (ca->ndx != cb->ndx) return (ca->ndx < cb->ndx ? -1 : 1);
+
+    return (0);
+}
+
+
+/*  Closest first (then by index so that ties always come out the same) sort function for the neighbor lists.  */
+
+static int32_t compare_near (const void *a, const void *b)
+{
+    NEAR_REC *na = (NEAR_REC *) (a);
+    NEAR_REC *nb = (NEAR_REC *) (b);
+
+    if (na->dist != nb->dist) return (na->dist < nb->dist ? -1 : 1);
+    if (na->ndx != nb->ndx) return (na->ndx < nb->ndx ? -1 : 1);
+
+    return (0);
+}
+
+
+/*  Isolation pass task (see filter_band).  */
+
+static void isolation_task (void *data, int32_t thread, int32_t t)
+{
+  BAND_WORK *work = (BAND_WORK *) data;
+  MISC *misc = work->misc;
+  BIN_GRID *grid = work->grid;
+  BAND_TASK *task = &work->task[t];
+  TRACE_REC trace_rec;
+  TRACE_REC *trace = misc->trace ? &trace_rec : NULL;
+  int32_t stencil[HWF_MAX_STENCIL];
+
+
+  //  Same type as in ABE_SHARE so that the distance sums round the same way they always have.
+
+  decltype (misc->abe_share->filterShare.search_radius) search_radius = misc->abe_share->filterShare.search_radius;
+  float bin_size = (float) grid->bin_size;
+
+  for (int32_t i = task->bin ; i < grid->bin_count && grid->bin[i].start < task->end ; i++)
+    {
+      BIN_DATA *bin = &grid->bin[i];
+
+
+      //  Only the rows that can affect the band's own rows (see filter_band).
+
+      if (bin->crow < work->first_row - 1 || bin->crow > work->last_row + 1) continue;
+
+
+      int32_t cells = -1, near_line = HWF_NO_LINE;
+      int32_t c_start = qMax (bin->start, task->start);
+      int32_t c_end = qMin (bin->start + bin->count, task->end);
+
+
+      //  Loop through the current cell (or our part of it) checking against all points in any of the cells around it.
+
+      for (int32_t c = c_start ; c < c_end ; c++)
+        {
+          //  If we've already determined that this point doesn't need to be checked we can move on.
+
+          if (get_flags (grid, c) & HWF_CHECK)
+            {
+              uint8_t only_one_line = NVTrue, done = NVFalse;
+              uint8_t killed = get_flags (grid, c) & HWF_KILLED;
+              float base = (float) search_radius + grid->herr[c];
+              int32_t first[9];
+
+              for (int32_t s = 0 ; s < 9 ; s++) first[s] = -1;
+
+
+              //  The cells in the 9 bin block that are close enough to the current cell to matter (only looked up once per cell),
+              //  and the line of all of the usable points in them if there's only one.
+
+              if (cells < 0)
+                {
+                  cells = stencil_cells (grid, i, stencil);
+
+                  for (int32_t s = 0 ; s < cells && near_line != HWF_MIXED_LINES ; s++)
+                    {
+                      int32_t line = grid->bin[stencil[s]].usable_line;
+
+                      if (line == HWF_MIXED_LINES || (line != HWF_NO_LINE && near_line != HWF_NO_LINE && line != near_line))
+                        {
+                          near_line = HWF_MIXED_LINES;
+                        }
+                      else if (line != HWF_NO_LINE)
+                        {
+                          near_line = line;
+                        }
+                    }
+                }
+
+
+              //  If there aren't any usable points from another line anywhere in the stencil we can't find a neighbor, so the
+              //  point is from a single line and there's no need to look at the cells at all.
+
+              int32_t search = (near_line == HWF_NO_LINE || near_line == grid->line_num[c]) ? 0 : cells;
+
+
+              //  Cell loop.
+
+              for (int32_t s = 0 ; s < search && !done ; s++)
+                {
+                  BIN_DATA *nbin = &grid->bin[stencil[s]];
+
+
+                  //  Skip the cell if it's too far away to hold a neighbor.
+
+                  if (!cell_in_reach (grid, nbin, grid->mx[c], grid->my[c], search_radius + grid->herr[c])) continue;
+
+
+                  //  Which of the 9 bins the cell is in.
+
+                  int32_t slot = (nbin->crow - bin->crow + 1) * 3 + nbin->ccol - bin->ccol + 1;
+
+
+                  //  The current point's position relative to the lower left corner of the neighbor cell (for neighbor_mask).
+
+                  float cx = grid->lx[c] - (float) (nbin->col - bin->col) * bin_size;
+                  float cy = grid->ly[c] - (float) (nbin->row - bin->row) * bin_size;
+
+
+                  //  Loop through the lines in the bin.  If the points are in the same line we don't check them (this also
+                  //  keeps us from checking the point against itself).
+
+                  for (int32_t l = nbin->line_start ; l < nbin->line_start + nbin->line_count && !done ; l++)
+                    {
+                      if (grid->line[l].line == grid->line_num[c]) continue;
+
+
+                      //  Loop though all points in the line 32 at a time.  neighbor_mask gives us the ones that might be close
+                      //  enough so we only do the full test on those (in the same order as before).
+
+                      int32_t end = grid->line[l].start + grid->line[l].count;
+                      uint8_t found = NVFalse;
+
+                      for (int32_t p0 = grid->line[l].start ; p0 < end && !found ; p0 += 32)
+                        {
+                          uint32_t mask = neighbor_mask (grid, p0, qMin (32, end - p0), cx, cy, base);
+
+                          for ( ; mask && !found ; mask &= mask - 1)
+                            {
+                              int32_t p = p0 + __builtin_ctz (mask);
+
+                              //  Don't check against invalid data.
+
+                              if (get_flags (grid, p) & HWF_USABLE)
+                                {
+                                  //  Simple check for exceeding distance in X or Y direction (prior to a radius check).
+
+                                  double diff_x = fabs (grid->mx[c] - grid->mx[p]);
+                                  double diff_y = fabs (grid->my[c] - grid->my[p]);
+
+                                  double dist = search_radius + grid->herr[c] + grid->herr[p];
+
+                                  if (diff_x <= dist && diff_y <= dist)
+                                    {
+                                      //  Next check the distance.  If we're within this distance, the point is valid, and it's from a different file
+                                      //  we don't need to check either of these points.
+
+                                      if (sqrt (diff_x * diff_x + diff_y * diff_y) <= dist)
+                                        {
+                                          only_one_line = NVFalse;
+
+
+                                          //  Finally we check the Z difference.
+
+                                          if (fabs (grid->z[c] - grid->z[p]) < ((grid->verr[c] + grid->verr[p]) / 2.0))
+                                            {
+                                              clear_check (grid, c);
+
+                                              if (!killed) done = NVTrue;
+
+                                              if (first[slot] < 0 || grid->data[p] < grid->data[first[slot]]) first[slot] = p;
+                                              found = NVTrue;
+                                            }
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+
+
+              //  A point killed by the return filter clears the first consistent neighbor in each of the 9 bins.
+
+              if (killed)
+                {
+                  for (int32_t s = 0 ; s < 9 ; s++) if (first[s] >= 0) clear_check (grid, first[s]);
+                }
+
+
+              //  If there was only data from a single line within the radius we're not going to try to filter this point.
+              //  That is a job for the analyst.
+
+              if (only_one_line)
+                {
+                  clear_check (grid, c);
+
+
+                  //  The rows around the band are done again in the next band so only trace the band's own rows.
+
+                  if (trace && bin->crow >= work->first_row && bin->crow <= work->last_row)
+                    {
+                      memset (trace, 0, sizeof (TRACE_REC));
+                      trace->ndx = work->wave_data[grid->data[c]].ndx;
+                      trace->rule = HWF_RULE_ONE_LINE;
+                      trace->channel = HWF_NO_CHANNEL;
+                      trace_record (misc, thread, trace);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/*  Neighbor gather task (see filter_band).  */
+
+static void gather_task (void *data, int32_t thread, int32_t t)
+{
+  BAND_WORK *work = (BAND_WORK *) data;
+  MISC *misc = work->misc;
+  BIN_GRID *grid = work->grid;
+  BAND_TASK *task = &work->task[t];
+  TRACE_REC trace_rec;
+  TRACE_REC *trace = misc->trace ? &trace_rec : NULL;
+  int32_t stencil[HWF_MAX_STENCIL];
+
+  decltype (misc->abe_share->filterShare.search_radius) search_radius = misc->abe_share->filterShare.search_radius;
+  float bin_size = (float) grid->bin_size;
+
+  for (int32_t i = task->bin ; i < grid->bin_count && grid->bin[i].start < task->end ; i++)
+    {
+      BIN_DATA *bin = &grid->bin[i];
+
+
+      //  Only the band's own rows.
+
+      if (bin->crow < work->first_row || bin->crow > work->last_row) continue;
+
+
+      int32_t cells = -1;
+      int32_t c_start = qMax (bin->start, task->start);
+      int32_t c_end = qMin (bin->start + bin->count, task->end);
+
+
+      //  Loop through the current cell (or our part of it) checking against all points in any of the cells around it.
+
+      for (int32_t c = c_start ; c < c_end ; c++)
+        {
+          //  If we've already determined that this point doesn't need to be checked we can move on.  If the return filter
+          //  already killed it there's no need to look at its neighbors.
+
+          if ((grid->flags[c] & (HWF_CHECK | HWF_KILLED)) == HWF_CHECK)
+            {
+              if (task->cand_count == task->cand_size)
+                {
+                  task->cand_size = qMax (256, task->cand_size * 2);
+
+                  if ((task->cand = (CANDIDATE *) realloc (task->cand, task->cand_size * sizeof (CANDIDATE))) == NULL)
+                    {
+                      perror ("Allocating candidate memory in filter_band.cpp");
+                      task->error = NVTrue;
+                      return;
+                    }
+                }
+
+              CANDIDATE *cand = &task->cand[task->cand_count];
+
+              cand->ndx = grid->data[c];
+              cand->row = bin->crow;
+              cand->col = bin->ccol;
+              cand->start = task->nbr_count;
+
+              float base = (float) search_radius + grid->herr[c];
+
+
+              //  Only look up the cells around the current cell if something in it is a candidate.
+
+              if (cells < 0) cells = stencil_cells (grid, i, stencil);
+
+
+              //  Cell loop.
+
+              for (int32_t s = 0 ; s < cells ; s++)
+                {
+                  BIN_DATA *nbin = &grid->bin[stencil[s]];
+
+                  if (!cell_in_reach (grid, nbin, grid->mx[c], grid->my[c], search_radius + grid->herr[c])) continue;
+
+                  float cx = grid->lx[c] - (float) (nbin->col - bin->col) * bin_size;
+                  float cy = grid->ly[c] - (float) (nbin->row - bin->row) * bin_size;
+
+
+                  //  Loop through the lines in the bin skipping the current point's line.
+
+                  for (int32_t l = nbin->line_start ; l < nbin->line_start + nbin->line_count ; l++)
+                    {
+                      if (grid->line[l].line == grid->line_num[c]) continue;
+
+
+                      //  Loop though all points in the line 32 at a time.  neighbor_mask gives us the ones that might be close
+                      //  enough so we only do the full test on those (in the same order as before).
+
+                      int32_t end = grid->line[l].start + grid->line[l].count;
+
+                      for (int32_t p0 = grid->line[l].start ; p0 < end ; p0 += 32)
+                        {
+                          uint32_t mask = neighbor_mask (grid, p0, qMin (32, end - p0), cx, cy, base);
+
+                          for ( ; mask ; mask &= mask - 1)
+                            {
+                              int32_t p = p0 + __builtin_ctz (mask);
+
+                              //  Don't check against invalid data.
+
+                              if (grid->flags[p] & HWF_USABLE)
+                                {
+                                  //  Simple check for exceeding distance in X or Y direction (prior to a radius check).
+
+                                  double diff_x = fabs (grid->mx[c] - grid->mx[p]);
+                                  double diff_y = fabs (grid->my[c] - grid->my[p]);
+
+                                  double dist = search_radius + grid->herr[c] + grid->herr[p];
+
+                                  if (diff_x <= dist && diff_y <= dist)
+                                    {
+                                      //  Next check the distance.
+
+                                      if (sqrt (diff_x * diff_x + diff_y * diff_y) <= dist)
+                                        {
+                                          if (task->nbr_count == task->nbr_size)
+                                            {
+                                              task->nbr_size = qMax (1024, task->nbr_size * 2);
+
+                                              if ((task->nbr = (int32_t *) realloc (task->nbr, task->nbr_size * sizeof (int32_t))) == NULL)
+                                                {
+                                                  perror ("Allocating neighbor memory in filter_band.cpp");
+                                                  task->error = NVTrue;
+                                                  return;
+                                                }
+                                            }
+
+                                          task->nbr[task->nbr_count] = grid->data[p];
+                                          task->nbr_count++;
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+
+              cand->count = task->nbr_count - cand->start;
+
+
+              //  Sort the neighbors closest first so that the waveform check reads the ones most likely to support the point
+              //  first (see filter_band).
+
+              if (cand->count > 1)
+                {
+                  if (cand->count > task->near_size)
+                    {
+                      task->near_size = qMax (256, cand->count);
+
+                      if ((task->near = (NEAR_REC *) realloc (task->near, task->near_size * sizeof (NEAR_REC))) == NULL)
+                        {
+                          perror ("Allocating neighbor sort memory in filter_band.cpp");
+                          task->error = NVTrue;
+                          return;
+                        }
+                    }
+
+                  for (int32_t p = 0 ; p < cand->count ; p++)
+                    {
+                      int32_t indx = task->nbr[cand->start + p];
+                      double dx = work->wave_data[indx].mx - grid->mx[c];
+                      double dy = work->wave_data[indx].my - grid->my[c];
+
+                      task->near[p].dist = dx * dx + dy * dy;
+                      task->near[p].ndx = indx;
+                    }
+
+                  qsort (task->near, cand->count, sizeof (NEAR_REC), compare_near);
+
+                  for (int32_t p = 0 ; p < cand->count ; p++) task->nbr[cand->start + p] = task->near[p].ndx;
+                }
+
+              if (trace)
+                {
+                  memset (trace, 0, sizeof (TRACE_REC));
+                  trace->ndx = work->wave_data[cand->ndx].ndx;
+                  trace->rule = HWF_RULE_ISOLATION;
+                  trace->channel = HWF_NO_CHANNEL;
+                  trace->count = cand->count;
+                  trace_record (misc, thread, trace);
+                }
+
+              task->cand_count++;
+            }
+        }
+    }
+}
+
+
+/*  Free the per task lists.  */
+
+static void free_tasks (BAND_TASK *task, int32_t task_count)
+{
+  for (int32_t t = 0 ; t < task_count ; t++)
+    {
+      if (task[t].cand) free (task[t].cand);
+      if (task[t].nbr) free (task[t].nbr);
+      if (task[t].near) free (task[t].near);
+    }
+
+  if (task) free (task);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        filter_band                                         *
+*                                                                           *
+*   Purpose:            Run the proximity search and the waveform check on  *
+*                       one band of bin rows.  wave_data must hold every    *
+*                       point in the band plus two rows of bins on either   *
+*                       side of it (already run through ingest_points) in   *
+*                       misc.data index order.  Only the points in rows     *
+*                       first_row through last_row are checked.  Bands must *
+*                       be done from the bottom up so that the waveform     *
+*                       check is done in the same order as for the whole    *
+*                       area at once.  The proximity passes are run on the  *
+*                       worker pool.  The bin grid and the candidate lists  *
+*                       are carved out of misc->arena and are left for      *
+*                       filter_area to release.  If the --time_budget runs  *
+*                       out the band is stopped part way and misc->partial  *
+*                       is set (what was flagged by then is still right).   *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       wave_data      - the per point data for the band    *
+*                       count          - number of entries in wave_data     *
+*                       first_row      - first bin row of the band          *
+*                       last_row       - last bin row of the band           *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t filter_band (MISC *misc, WAVE_DATA *wave_data, int32_t count, int32_t first_row, int32_t last_row, char *progname)
+{
+  QElapsedTimer timer;
+  int64_t start = 0;
+  TRACE_REC trace_rec;
+  TRACE_REC *trace = misc->trace ? &trace_rec : NULL;
+
+  timer.start ();
+
+
+  //  Now we need to build an array of bins (twice the size of the search radius) so that we can efficiently perform the dreaded
+  //  Hockey Puck of Confidence (TM) proximity valid point search.  Only the bins that have points in them are stored.  The bins
+  //  may be split into smaller cells (see tune_band) so that the searches can skip the parts of the 9 bin block that are out of
+  //  reach.
+
+  BIN_GRID grid;
+
+  int32_t split = tune_band (misc, wave_data, count, progname);
+
+  if (!build_bin_grid (misc, wave_data, count, misc->abe_share->filterShare.search_radius * 2.0, split, &grid)) return (NVFalse);
+
+
+  //  Cut the grid up into tasks of about misc->task_points points for the worker pool.
+
+  BAND_TASK *task = NULL;
+  int32_t task_count = 0, task_size = 0, target = qMax (1, misc->task_points);
+
+  for (int32_t i = 0 ; i < grid.bin_count ; i++)
+    {
+      BIN_DATA *bin = &grid.bin[i];
+      int32_t end = bin->start + bin->count;
+
+
+      //  Add the bin to the last task if it fits.
+
+      if (task_count && task[task_count - 1].end - task[task_count - 1].start + bin->count <= target)
+        {
+          task[task_count - 1].end = end;
+          continue;
+        }
+
+
+      //  Otherwise it starts a new task (or a few if it has too many points for one).
+
+      for (int32_t p = bin->start ; p < end ; p += target)
+        {
+          if (task_count == task_size)
+            {
+              task_size = qMax (64, task_size * 2);
+
+              BAND_TASK *new_task = (BAND_TASK *) realloc (task, task_size * sizeof (BAND_TASK));
+              if (new_task == NULL)
+                {
+                  perror ("Allocating task memory in filter_band.cpp");
+                  free_tasks (task, task_count);
+                  return (NVFalse);
+                }
+              task = new_task;
+            }
+
+          memset (&task[task_count], 0, sizeof (BAND_TASK));
+          task[task_count].bin = i;
+          task[task_count].start = p;
+          task[task_count].end = qMin (p + target, end);
+          task_count++;
+        }
+    }
+
+  BAND_WORK work;
+
+  work.misc = misc;
+  work.wave_data = wave_data;
+  work.grid = &grid;
+  work.task = task;
+  work.first_row = first_row;
+  work.last_row = last_row;
+
+  misc->stage_ns[1] += timer.nsecsElapsed () - start;
+  start = timer.nsecsElapsed ();
+
+
+  //  Determine which points need to have their waveforms evaluated.  This uses the dreaded Hockey Puck of Confidence (TM).  We only want
+  //  to search in one bin around the current bin.  This means we'll search 9 total bins and that should give us enough nearby data for
+  //  any point in the center bin.  Since the points in each bin are grouped by line we can skip the current point's line in one step.
+  //  Both of the proximity passes work on the columns in the bin grid (indexed by position in the grid) instead of POINT_CLOUD.
+  //
+  //  A point that has a depth consistent neighbor from another line doesn't need to be checked and neither does that neighbor.  When
+  //  the point itself is valid the neighbor will find it when its own turn comes so we can stop looking as soon as we find one.  Points
+  //  that were killed by the return filter aren't used as neighbors though, so in that case we have to clear the neighbor ourselves.
+  //  We clear the first (lowest point number) consistent neighbor in each bin since that's the one we used to stop at when the bins
+  //  were in point order.
+  //
+  //  This pass doesn't depend on the order the points are done in and doing a point more than once doesn't change anything, so
+  //  for a band we just do the rows next to the band as well.  That way the check flags in the band's own rows come out the same
+  //  as if we had done the whole area.  It also means the tasks can be run in any order on any number of threads.  The only flags
+  //  that change are the check flags of valid points and clearing one of those never changes what happens to another point.
+
+  if (!run_pool (misc, misc->band_threads, task_count, isolation_task, &work))
+    {
+      free_tasks (task, task_count);
+      return (NVFalse);
+    }
+
+
+  //  With --time_budget we may have to stop part way through the band.  Nothing has been flagged yet so we just leave.
+
+  if (out_of_time (misc))
+    {
+      free_tasks (task, task_count);
+      misc->partial = NVTrue;
+      return (NVTrue);
+    }
+
+  misc->stage_ns[2] += timer.nsecsElapsed () - start;
+  start = timer.nsecsElapsed ();
+
+
+  //  Now we gather the points within the search radius of each point that still needs to be checked.  We do this before looking
+  //  at any waveforms so that we only have to read the waveforms that the waveform check is actually going to use.  Again, we
+  //  only search the 9 bin block around the current bin and skip the point's own line.  The flags don't change in this pass so
+  //  the tasks only have to keep their candidates and neighbor lists to themselves.
+
+  uint8_t status = run_pool (misc, misc->band_threads, task_count, gather_task, &work);
+
+  for (int32_t t = 0 ; t < task_count ; t++) if (task[t].error) status = NVFalse;
+
+
+  //  Put the task lists together (in task order) into one candidate list and one neighbor list (wave_data indices stored end
+  //  to end in nbr[]).
+
+  CANDIDATE *cand = NULL;
+  int32_t *nbr = NULL, *load = NULL;
+  int32_t cand_count = 0, nbr_count = 0, load_size = 0;
+
+  if (status)
+    {
+      for (int32_t t = 0 ; t < task_count ; t++)
+        {
+          cand_count += task[t].cand_count;
+          nbr_count += task[t].nbr_count;
+        }
+
+      cand = (CANDIDATE *) arena_alloc (&misc->arena, qMax (cand_count, 1) * sizeof (CANDIDATE), NVFalse);
+      nbr = (int32_t *) arena_alloc (&misc->arena, qMax (nbr_count, 1) * sizeof (int32_t), NVFalse);
+      if (cand == NULL || nbr == NULL)
+        {
+          perror ("Allocating candidate memory in filter_band.cpp");
+          status = NVFalse;
+        }
+    }
+
+  if (!status)
+    {
+      free_tasks (task, task_count);
+      return (NVFalse);
+    }
+
+  cand_count = nbr_count = 0;
+
+  for (int32_t t = 0 ; t < task_count ; t++)
+    {
+      for (int32_t k = 0 ; k < task[t].cand_count ; k++)
+        {
+          cand[cand_count] = task[t].cand[k];
+          cand[cand_count].start += nbr_count;
+          cand_count++;
+        }
+
+      if (task[t].nbr_count) memcpy (&nbr[nbr_count], task[t].nbr, task[t].nbr_count * sizeof (int32_t));
+      nbr_count += task[t].nbr_count;
+    }
+
+  free_tasks (task, task_count);
+
+
+  misc->stage_ns[3] += timer.nsecsElapsed () - start;
+  start = timer.nsecsElapsed ();
+
+
+  //  The bins are in Morton order and the points in each bin are grouped by line so we have to put the candidates back in
+  //  row/column/point order.  That's the order the waveform check has always been done in (it matters, see below).
+
+  qsort (cand, cand_count, sizeof (CANDIDATE), compare_candidates);
+
+
+  //  Now let's do the waveform check on those points that need it.  Just like we used to do when we gathered the neighbors on
+  //  the fly, a point that has been killed by the waveform check isn't used to support any of the points after it.
+  //
+  //  Reading the waveforms is by far the slowest part of this and one rising neighbor is all it takes to keep a point, so we
+  //  don't read them all up front.  In the first round we only read the closest HWF_FIRST_NEIGHBORS neighbors of each point
+  //  (the neighbor lists are sorted closest first) and go through the points in order.  A point is decided if one of those
+  //  neighbors rises or if we already have everything we need to kill it.  Otherwise it's left for the second round and so is
+  //  any later point that it could support.  In the second round we read the rest of the neighbors of the points that are left
+  //  and go through them again in order, which decides all of them.  Since a point is only ever decided from neighbors whose
+  //  fate is already known the results are exactly the same as checking every point against every neighbor in order.
+
+  //
+  //  The neighbor tests only look at three bit sets (indexed by wave_data index) until they get to a neighbor that is also a
+  //  candidate.  cand_bits marks the candidates, dead_bits marks the other points that were already killed (before this band's
+  //  waveform check), and loaded_bits marks the points whose waveforms have been read.
+
+  int32_t words = HWF_BIT_WORDS (qMax (count, 1));
+  int32_t *cand_of = (int32_t *) arena_alloc (&misc->arena, qMax (count, 1) * sizeof (int32_t), NVFalse);
+  uint8_t *decision = (uint8_t *) arena_alloc (&misc->arena, qMax (cand_count, 1) * sizeof (uint8_t), NVTrue);
+  uint64_t *cand_bits = (uint64_t *) arena_alloc (&misc->arena, 3 * words * sizeof (uint64_t), NVTrue);
+  int32_t max_count = 1;
+
+  for (int32_t k = 0 ; k < cand_count ; k++) max_count = qMax (max_count, cand[k].count);
+
+  int32_t *points = (int32_t *) arena_alloc (&misc->arena, max_count * sizeof (int32_t), NVFalse);
+
+  if (cand_of == NULL || decision == NULL || cand_bits == NULL || points == NULL)
+    {
+      perror ("Allocating waveform check memory in filter_band.cpp");
+      return (NVFalse);
+    }
+
+  uint64_t *dead_bits = &cand_bits[words];
+  uint64_t *loaded_bits = &cand_bits[2 * words];
+
+  for (int32_t k = 0 ; k < cand_count ; k++)
+    {
+      cand_of[cand[k].ndx] = k;
+      HWF_BIT_SET (cand_bits, cand[k].ndx);
+    }
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      if (!HWF_BIT_TEST (cand_bits, i) && HWF_BIT_TEST (misc->kill_bits, wave_data[i].ndx)) HWF_BIT_SET (dead_bits, i);
+    }
+
+  misc->waveform_count = 0;
+  misc->waveform = NULL;
+  misc->packed = NULL;
+  misc->packed_data = NULL;
+  misc->packed_size = misc->packed_alloc = 0;
+  misc->block_cache = NULL;
+
+  misc->stage_ns[5] += timer.nsecsElapsed () - start;
+  start = timer.nsecsElapsed ();
+
+  //  If the time budget runs out we stop where we are.  Every point that has been flagged by then was only flagged once its
+  //  neighbors' fates were known so it would have been flagged anyway.
+
+  uint8_t stopped = NVFalse;
+
+  for (int32_t round = 0 ; round < 2 && !stopped ; round++)
+    {
+      //  Put each neighbor that we need this round on the load list the first time we see it (load_waveforms gives it a pool
+      //  slot).  There's no need to read a neighbor that was killed by the waveform check before the point it would support.
+
+      int32_t load_count = 0;
+
+      for (int32_t k = 0 ; k < cand_count ; k++)
+        {
+          if (decision[k] != HWF_UNDECIDED) continue;
+
+          int32_t end = cand[k].start + (round ? cand[k].count : qMin (cand[k].count, HWF_FIRST_NEIGHBORS));
+
+          for (int32_t p = cand[k].start ; p < end ; p++)
+            {
+              int32_t indx = nbr[p];
+
+              if (HWF_BIT_TEST (loaded_bits, indx) || HWF_BIT_TEST (dead_bits, indx)) continue;
+
+              if (HWF_BIT_TEST (cand_bits, indx) && cand_of[indx] < k && decision[cand_of[indx]] == HWF_KILL) continue;
+
+              if (load_count == load_size)
+                {
+                  load_size = qMax (1024, load_size * 2);
+
+                  if ((load = (int32_t *) realloc (load, load_size * sizeof (int32_t))) == NULL)
+                    {
+                      perror ("Allocating load list memory in filter_band.cpp");
+                      return (NVFalse);
+                    }
+                }
+
+              load[load_count] = indx;
+              load_count++;
+              HWF_BIT_SET (loaded_bits, indx);
+            }
+        }
+
+
+      //  Read the waveforms for this round.
+
+      if (out_of_time (misc))
+        {
+          stopped = NVTrue;
+          break;
+        }
+
+      if (!load_waveforms (misc, wave_data, load, load_count, progname)) return (NVFalse);
+
+
+      misc->stage_ns[4] += timer.nsecsElapsed () - start;
+      start = timer.nsecsElapsed ();
+
+
+      for (int32_t k = 0 ; k < cand_count ; k++)
+        {
+          if (decision[k] != HWF_UNDECIDED) continue;
+
+          if (!(k & 63) && out_of_time (misc))
+            {
+              stopped = NVTrue;
+              break;
+            }
+
+
+          //  Only the neighbors that are still valid at this point in the check order.  Earlier points have to have been decided
+          //  (and kept), later points haven't been looked at yet so they're still valid.  Anything we haven't read or that
+          //  depends on an undecided point means we can only decide this point if one of the others rises.
+
+          uint8_t unknown = NVFalse;
+
+          misc->points = points;
+          misc->point_count = 0;
+
+          for (int32_t p = cand[k].start ; p < cand[k].start + cand[k].count ; p++)
+            {
+              int32_t indx = nbr[p];
+
+              if (HWF_BIT_TEST (dead_bits, indx)) continue;
+
+              if (HWF_BIT_TEST (cand_bits, indx))
+                {
+                  int32_t j = cand_of[indx];
+
+                  if (j < k && decision[j] == HWF_KILL) continue;
+
+                  if (j < k && decision[j] == HWF_UNDECIDED)
+                    {
+                      unknown = NVTrue;
+                      continue;
+                    }
+                }
+
+              if (!HWF_BIT_TEST (loaded_bits, indx))
+                {
+                  unknown = NVTrue;
+                  continue;
+                }
+
+              misc->points[misc->point_count] = indx;
+              misc->point_count++;
+            }
+
+
+          if (!waveform_check (misc, wave_data, cand[k].ndx, trace))
+            {
+              decision[k] = HWF_KEEP;
+            }
+          else if (!unknown)
+            {
+              //  No supporting waveforms.
+
+              decision[k] = HWF_KILL;
+              HWF_BIT_SET (misc->kill_bits, wave_data[cand[k].ndx].ndx);
+            }
+          else
+            {
+              continue;
+            }
+
+          if (trace)
+            {
+              trace->ndx = wave_data[cand[k].ndx].ndx;
+              trace->pad = 0;
+              trace_record (misc, 0, trace);
+            }
+        }
+
+      misc->stage_ns[5] += timer.nsecsElapsed () - start;
+      start = timer.nsecsElapsed ();
+    }
+
+  if (load) free (load);
+
+  if (stopped) misc->partial = NVTrue;
+
+  misc->binned += grid.count;
+  misc->bins += grid.bin_count;
+  misc->checks += cand_count;
+  misc->loaded += misc->waveform_count;
+
+
+  if (misc->waveform) free (misc->waveform);
+  if (misc->packed) free (misc->packed);
+  if (misc->packed_data) free (misc->packed_data);
+  if (misc->block_cache) free (misc->block_cache);
+
+  misc->waveform = NULL;
+  misc->packed = NULL;
+  misc->packed_data = NULL;
+  misc->block_cache = NULL;
+
+
+  return (NVTrue);
+}
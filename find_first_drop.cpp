@@ -0,0 +1,80 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        find_first_drop                                     *
+*                                                                           *
+*   Purpose:            Find the first drop (the end of the surface return) *
+*                       in an APD or PMT waveform.  This only depends on    *
+*                       the waveform so the return filters can share it     *
+*                       between the primary and secondary returns of a      *
+*                       shot.                                               *
+*                                                                           *
+*   Arguments:          wave           - the waveform                       *
+*                       size           - number of bins in the waveform     *
+*                                                                           *
+*   Return Value:       int32_t        - the first drop bin (0 if there     *
+*                                        isn't one)                         *
+*                                                                           *
+\***************************************************************************/
+
+int32_t find_first_drop (uint8_t *wave, int32_t size)
+{
+  int32_t drop = 0;
+
+
+  //  Loop through the data looking for the first drop (from the surface).  Skip the first 20 bins so that we don't start
+  //  looking in the noisy section prior to the surface return.
+
+  for (int32_t i = 20 ; i < size ; i++)
+    {
+      //  If we get three zeros in a row we want to reset the drop counter.
+
+      int32_t change = (wave[i] - wave[i - 1]) + (wave[i - 1] - wave[i - 2]) +
+        (wave[i - 2] - wave[i - 3]);
+
+      if (!change) drop = 0;
+
+
+      if (wave[i] - wave[i - 1] <= 0)
+        {
+          //  Increment the drop counter.
+
+          drop++;
+
+
+          if (drop >= 5) return (i);
+        }
+      else
+        {
+          drop = 0;
+        }
+    }
+
+
+  return (0);
+}
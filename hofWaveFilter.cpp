@@ -49,54 +49,60 @@ int32_t main (int32_t argc, char **argv)
 }
 
 
-/*  This is the PFM/file/rec sort function for qsort.  */
-
-static int32_t compare_pfm_file_numbers (const void *a, const void *b)
-{
-    SORT_REC *sa = (SORT_REC *) (a);
-    SORT_REC *sb = (SORT_REC *) (b);
-
-
-    //  If the lines aren't equal we sort on line.
-
-    if (sa->pfm_file != sb->pfm_file) return (sa->pfm_file < sb->pfm_file ? 0 : 1);
-
-
-    //  Otherwise we sort on the original record number.
-
-    return (sa->orig_rec < sb->orig_rec ? 0 : 1);
-}
-
-
-
 void hofWaveFilter::usage ()
 {
   fprintf (stderr, "\nUsage: hofWaveFilter --shared_memory_key SHARED_MEMORY_KEY\n");
   fprintf (stderr, "This program is not meant to be run from the command line.  It should only be\n");
   fprintf (stderr, "run as a QProcess from pfmEdit or pfmEdit3D.\n\n");
+  fprintf (stderr, "Options:\n\n");
+  fprintf (stderr, "  --stats                 print stage times and counts to stderr\n");
+  fprintf (stderr, "  --compress_waveforms    keep the waveforms used by the waveform check compressed\n");
+  fprintf (stderr, "                          in memory (slower but uses much less memory)\n");
+  fprintf (stderr, "  --memory_budget MB      do the area in bands of about MB megabytes each instead\n");
+  fprintf (stderr, "                          of all at once (same results, for very large areas)\n");
+  fprintf (stderr, "  --trace FILE            record why each point was killed or kept and write it\n");
+  fprintf (stderr, "                          to FILE when done\n");
+  fprintf (stderr, "  --decode_trace FILE     print a trace file and exit\n");
+  fprintf (stderr, "  --verify                also run the reference (unoptimized) filter and report\n");
+  fprintf (stderr, "                          any point where the results differ\n");
+  fprintf (stderr, "  --verify_synthetic N    compare against the reference filter on N synthetic\n");
+  fprintf (stderr, "                          point clouds and exit (no shared memory needed)\n");
+  fprintf (stderr, "  --cell_split N          split the search bins into N by N cells (1 to %d, the\n", HWF_MAX_SPLIT);
+  fprintf (stderr, "                          default is to pick it from the point density)\n");
+  fprintf (stderr, "  --threads N             use at most N worker threads (default is the number\n");
+  fprintf (stderr, "                          of processors)\n");
+  fprintf (stderr, "  --io_depth N            read up to N HOF/INH records ahead (default %d, 0 to\n", HWF_IO_DEPTH);
+  fprintf (stderr, "                          turn read ahead off)\n");
+  fprintf (stderr, "  --huge_pages N          0 for normal pages, 1 for transparent huge pages (the\n");
+  fprintf (stderr, "                          default), 2 for explicit huge pages if the system has\n");
+  fprintf (stderr, "                          any set aside\n");
+  fprintf (stderr, "  --sweep FILE            run the filter once for each set of settings in FILE\n");
+  fprintf (stderr, "                          and print what each would kill without changing\n");
+  fprintf (stderr, "                          anything (keeps about 0.7 KB per HOF point in memory)\n");
+  fprintf (stderr, "  --capture FILE          save the ABE settings and the point cloud to FILE\n");
+  fprintf (stderr, "                          before filtering (for --replay)\n");
+  fprintf (stderr, "  --replay FILE           run on a --capture file instead of pfmEdit's shared\n");
+  fprintf (stderr, "                          memory (no --shared_memory_key needed, the PFM, HOF,\n");
+  fprintf (stderr, "                          and INH files must be where they were)\n");
+  fprintf (stderr, "  --time_budget MS        stop filtering after about MS milliseconds\n");
+  fprintf (stderr, "  --priority_area W,S,E,N filter the rows of this area (usually what's displayed)\n");
+  fprintf (stderr, "                          first\n\n");
+  fprintf (stderr, "With --time_budget or --priority_area the killed points are flagged in the point\n");
+  fprintf (stderr, "cloud as each band is done.  The point cloud shared memory is only locked while\n");
+  fprintf (stderr, "they're copied in, and after each copy the ABE modcode is set to\n");
+  fprintf (stderr, "PFM_CHARTS_HOF_DATA | 0x%x (HWF_MODCODE_PARTIAL).  pfmEdit(3D) can poll modcode\n", HWF_MODCODE_PARTIAL);
+  fprintf (stderr, "while we run and, when it has that bit set, lock the point cloud and read the\n");
+  fprintf (stderr, "flags.  When we're done modcode is PFM_CHARTS_HOF_DATA if the whole area was\n");
+  fprintf (stderr, "filtered or still has HWF_MODCODE_PARTIAL set if the time budget ran out.\n");
+  fprintf (stderr, "Without these options modcode is only ever set to PFM_CHARTS_HOF_DATA.\n\n");
   fflush (stderr);
 }
 
 
 hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
 {
-  char               wave_file[512], string[1024];
-  FILE               *fp = NULL, *wfp = NULL;
-  HOF_HEADER_T       hof_header;
-  HYDRO_OUTPUT_T     hof_record;
-  WAVE_HEADER_T      wave_header;
-  WAVE_DATA_T        wave_rec;
   char               c;
   extern char        *optarg;
-  int32_t            pmt_run_req = 0, apd_run_req = 0, pmt_ac_zero_offset = 0, apd_ac_zero_offset = 0;
-  float              slope_req = 0.50;
-
-
-  uint8_t pmt_return_filter (int32_t rec, int32_t sub_rec, HYDRO_OUTPUT_T *hof_record, int32_t pmt_run_req, float slope_req, int32_t ac_zero_offset,
-                             int32_t ac_off_req, WAVE_DATA_T *wave_rec);
-  uint8_t apd_return_filter (int32_t rec, int32_t sub_rec, HYDRO_OUTPUT_T *hof_record, int32_t apd_run_req, float slope_req, int32_t ac_zero_offset,
-                             int32_t ac_off_req, WAVE_DATA_T *wave_rec);
-  uint8_t waveform_check (MISC *misc, WAVE_DATA *wave_data, int32_t recnum);
 
 
   if (argc < 2)
@@ -110,10 +116,50 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
 
 
   int32_t option_index = 0;
-  int32_t key = 0;
+  int32_t key = 0, mb = 0, synthetic_cases = 0;
+  uint8_t verify = NVFalse;
+  char trace_file[512], decode_file[512], sweep_file[512], capture_file[512], replay_file[512];
+  trace_file[0] = decode_file[0] = sweep_file[0] = capture_file[0] = replay_file[0] = 0;
+  misc.trace = NULL;
+  misc.trace_threads = 0;
+  misc.synthetic = NULL;
+  misc.slope_req = 0.50;
+  misc.kill_bits = NULL;
+  misc.io_depth = HWF_IO_DEPTH;
+  misc.io_ring = NULL;
+  misc.io_reads = misc.hof_reads = misc.wave_reads = 0;
+  misc.batch_lanes = misc.batch_scalar = 0;
+  misc.huge_pages = 1;
+  arena_init (&misc.arena, misc.huge_pages);
+  misc.stats = NVFalse;
+  misc.compress = NVFalse;
+  misc.memory_budget = 0;
+  misc.time_budget = 0;
+  misc.priority = NVFalse;
+  misc.partial = NVFalse;
+  misc.progressive = NVFalse;
+  misc.cell_split = 0;
+  misc.threads = 0;
+
   while (NVTrue) 
     {
       static struct option long_options[] = {{"shared_memory_key", required_argument, 0, 0},
+                                             {"stats", no_argument, 0, 0},
+                                             {"compress_waveforms", no_argument, 0, 0},
+                                             {"memory_budget", required_argument, 0, 0},
+                                             {"trace", required_argument, 0, 0},
+                                             {"decode_trace", required_argument, 0, 0},
+                                             {"verify", no_argument, 0, 0},
+                                             {"verify_synthetic", required_argument, 0, 0},
+                                             {"cell_split", required_argument, 0, 0},
+                                             {"threads", required_argument, 0, 0},
+                                             {"io_depth", required_argument, 0, 0},
+                                             {"huge_pages", required_argument, 0, 0},
+                                             {"sweep", required_argument, 0, 0},
+                                             {"capture", required_argument, 0, 0},
+                                             {"replay", required_argument, 0, 0},
+                                             {"time_budget", required_argument, 0, 0},
+                                             {"priority_area", required_argument, 0, 0},
                                              {0, no_argument, 0, 0}};
 
       c = (char) getopt_long (argc, argv, "s", long_options, &option_index);
@@ -128,6 +174,86 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
             case 0:
 	      sscanf (optarg, "%d", &key);
               break;
+
+            case 1:
+              misc.stats = NVTrue;
+              break;
+
+            case 2:
+              misc.compress = NVTrue;
+              break;
+
+            case 3:
+              sscanf (optarg, "%d", &mb);
+              misc.memory_budget = (int64_t) qMax (mb, 1) * 1048576;
+              break;
+
+            case 4:
+              strncpy (trace_file, optarg, sizeof (trace_file) - 1);
+              trace_file[sizeof (trace_file) - 1] = 0;
+              break;
+
+            case 5:
+              strncpy (decode_file, optarg, sizeof (decode_file) - 1);
+              decode_file[sizeof (decode_file) - 1] = 0;
+              break;
+
+            case 6:
+              verify = NVTrue;
+              break;
+
+            case 7:
+              sscanf (optarg, "%d", &synthetic_cases);
+              break;
+
+            case 8:
+              sscanf (optarg, "%d", &misc.cell_split);
+              misc.cell_split = qMax (0, qMin (HWF_MAX_SPLIT, misc.cell_split));
+              break;
+
+            case 9:
+              sscanf (optarg, "%d", &misc.threads);
+              break;
+
+            case 10:
+              sscanf (optarg, "%d", &misc.io_depth);
+              misc.io_depth = qMax (0, qMin (1024, misc.io_depth));
+              break;
+
+            case 11:
+              sscanf (optarg, "%d", &misc.huge_pages);
+              misc.huge_pages = qMax (0, qMin (2, misc.huge_pages));
+              break;
+
+            case 12:
+              strncpy (sweep_file, optarg, sizeof (sweep_file) - 1);
+              sweep_file[sizeof (sweep_file) - 1] = 0;
+              break;
+
+            case 13:
+              strncpy (capture_file, optarg, sizeof (capture_file) - 1);
+              capture_file[sizeof (capture_file) - 1] = 0;
+              break;
+
+            case 14:
+              strncpy (replay_file, optarg, sizeof (replay_file) - 1);
+              replay_file[sizeof (replay_file) - 1] = 0;
+              break;
+
+            case 15:
+              sscanf (optarg, "%d", &misc.time_budget);
+              misc.time_budget = qMax (0, misc.time_budget);
+              break;
+
+            case 16:
+              if (sscanf (optarg, "%lf,%lf,%lf,%lf", &misc.priority_area.min_x, &misc.priority_area.min_y, &misc.priority_area.max_x,
+                          &misc.priority_area.max_y) != 4)
+                {
+                  usage ();
+                  exit (-1);
+                }
+              misc.priority = NVTrue;
+              break;
             }
 
           break;
@@ -143,6 +269,49 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
     }
 
 
+  //  The reference filter comparison and the sweep need the whole area done (and don't publish anything along the way).
+
+  if (verify || sweep_file[0])
+    {
+      misc.time_budget = 0;
+      misc.priority = NVFalse;
+    }
+
+  misc.progressive = (misc.time_budget || misc.priority);
+
+
+  //  Stage times (nanoseconds) and counts for the --stats option.
+
+  const char *stage_name[HWF_STAGES] = {"HOF read and return filter", "Binning", "Isolation pass", "Neighbor gather", "Waveform load",
+                                        "Waveform check"};
+
+  for (int32_t i = 0 ; i < HWF_STAGES ; i++) misc.stage_ns[i] = 0;
+  misc.bands = misc.binned = misc.bins = misc.checks = misc.loaded = 0;
+  misc.waveform = NULL;
+  misc.packed = NULL;
+  misc.packed_data = NULL;
+  misc.block_cache = NULL;
+  misc.block_reads = misc.block_decodes = 0;
+  for (int32_t i = 0 ; i <= HWF_MAX_SPLIT ; i++) misc.split_bands[i] = 0;
+
+
+  //  Unless we were told otherwise, use as many worker threads as we have processors (tune_band may use fewer for small bands).
+
+  misc.auto_threads = (misc.threads <= 0);
+  if (misc.auto_threads) misc.threads = QThread::idealThreadCount ();
+  misc.threads = qMax (1, qMin (HWF_MAX_THREADS, misc.threads));
+  for (int32_t i = 0 ; i < HWF_MAX_THREADS ; i++) misc.busy_ns[i] = misc.tasks[i] = misc.steals[i] = 0;
+  misc.band_threads = 1;
+  misc.task_points = 1;
+
+
+  //  Decoding a trace file and checking against the reference filter on synthetic data don't need anything from pfmEdit(3D).
+
+  if (decode_file[0]) exit (decode_trace (decode_file) ? 0 : -1);
+
+  if (synthetic_cases) exit (verify_synthetic (&misc, synthetic_cases, progname) ? 0 : -1);
+
+
   /******************************************* IMPORTANT NOTE ABOUT SHARED MEMORY **************************************** \
 
       This is a little note about the use of shared memory within the Area-Based Editor (ABE) programs.  If you read
@@ -164,6 +333,11 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
   \******************************************* IMPORTANT NOTE ABOUT SHARED MEMORY ****************************************/
 
 
+  //  With --replay we make our own stand in shared memory from a capture file and use that instead of pfmView's.
+
+  if (replay_file[0] && !replay_session (replay_file, &key, progname)) exit (-1);
+
+
   //  Get the shared memory area.  If it doesn't exist, quit.  It should have already been created by pfmView and passed from
   //  pfmEdit(3D).  The key is the process ID of the bin viewer (pfmView) plus _abe.
 
@@ -204,27 +378,33 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
   misc.data = (POINT_CLOUD *) misc.dataShare->data ();
 
 
-  //  Lock the shared memory so that pfmEdit(3D) can't do anything until we're done.
+  if (trace_file[0] && !trace_init (&misc, misc.threads))
+    {
+      misc.dataShare->detach ();
+      misc.abeShare->detach ();
+      exit (-1);
+    }
+
+
+  //  Lock the shared memory so that pfmEdit(3D) can't do anything until we're done.  With --time_budget or --priority_area
+  //  pfmEdit(3D) is supposed to be looking at the results as they come in so filter_area only locks it while it's copying
+  //  them in (see the usage message).
 
   misc.dataShare->lock ();
 
 
-  wave_data = (WAVE_DATA *) malloc (misc.abe_share->point_cloud_count * sizeof (WAVE_DATA));
-  if (wave_data == NULL)
-    {
-      perror ("Allocating wave_data in hofWaveFilter.cpp");
-      misc.dataShare->unlock ();
-      exit (-1);
-    }
+  //  Save the session for --replay before we change anything.
 
-  SORT_REC *sa = (SORT_REC *) malloc (misc.abe_share->point_cloud_count * sizeof (SORT_REC));
-  if (sa == NULL)
+  if (capture_file[0] && !capture_session (&misc, capture_file))
     {
-      perror ("Allocating sort array in hofWaveFilter.cpp");
       misc.dataShare->unlock ();
+      misc.dataShare->detach ();
+      misc.abeShare->detach ();
       exit (-1);
     }
 
+  if (misc.progressive) misc.dataShare->unlock ();
+
 
   //  Open the PFM files and compute the average bin size.
 
@@ -236,7 +416,7 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
         {
           fprintf (stderr, "%s %s %s %d - %s - %s\n", progname, __FILE__, __FUNCTION__, __LINE__, misc.abe_share->open_args[pfm].list_path,
                    pfm_error_str (pfm_error));
-          misc.dataShare->unlock ();
+          if (!misc.progressive) misc.dataShare->unlock ();
           exit (-1);
         }
       bin_size_meters += misc.abe_share->open_args[pfm].head.bin_size_xy;
@@ -248,645 +428,108 @@ hofWaveFilter::hofWaveFilter (int32_t argc, char **argv)
   init_geo_distance (bin_size_meters, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.max_x, misc.abe_share->edit_area.max_y);
 
 
-  //  Stuff the record pointers into the sort array.
-
-  for (int32_t i = 0 ; i < misc.abe_share->point_cloud_count ; i++)
-    {
-      sa[i].pfm_file = misc.data[i].pfm * PFM_MAX_FILES + misc.data[i].file;
-      sa[i].orig_rec = misc.data[i].rec;
-      sa[i].rec = i;
-    }
-
-
-  //  Sort the records so we can read from each file in order.
-
-  qsort (sa, misc.abe_share->point_cloud_count, sizeof (SORT_REC), compare_pfm_file_numbers);
-
-
-  /*  Beginning of possible multithreading (to be used in a batch version of this program).
-
-  //  We need to find 3 break points to set up the possibility of 4 threads.  First, find the pfm_file change location nearest to the center of
-  //  the sorted point cloud array.
-
-  int32_t break_point[3];
-  break_point[1] = misc.abe_share->point_cloud_count / 2;
-  int32_t after = 0, before = 0;
-
-  for (int32_t i = break_point[1] ; i < misc.abe_share->point_cloud_count - 1 ; i++)
-    {
-      if (sa[i + 1].pfm_file != sa[i].pfm_file)
-        {
-          after = i + 1;
-          break;
-        }
-    }
-
-  for (int32_t i = break_point[1] ; i > 0 ; i--)
-    {
-      if (sa[i].pfm_file != sa[i - 1].pfm_file)
-        {
-          before = i;
-          break;
-        }
-    }
-
-  if (after - break_point[1] < break_point[1] - before)
-    {
-      break_point[1] = after;
-    }
-  else
-    {
-      break_point[1] = before;
-    }
-
-  fprintf (stderr,"%s %s %d %d %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,before,after,misc.abe_share->point_cloud_count,misc.data[before].file,misc.data[after].file,break_point[1]);
-
-  //  Find the file change location nearest to the mid-point of the section prior to break_point[1] determined above.
-
-  break_point[0] = break_point[1] / 2;
-  before = after = 0;
-
-  for (int32_t i = break_point[0] ; i < break_point[1] - 1 ; i++)
-    {
-      if (sa[i + 1].pfm_file != sa[i].pfm_file)
-        {
-          after = i + 1;
-          break;
-        }
-    }
-
-
-  for (int32_t i = break_point[0] ; i > 0 ; i--)
-    {
-      if (sa[i].pfm_file != sa[i - 1].pfm_file)
-        {
-          before = i;
-          break;
-        }
-    }
-
-  if (after - break_point[0] < break_point[0] - before)
-    {
-      break_point[0] = after;
-    }
-  else
-    {
-      break_point[0] = before;
-    }
-
-  fprintf (stderr,"%s %s %d %d %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,before,after,misc.abe_share->point_cloud_count,misc.data[before].file,misc.data[after].file,break_point[0]);
-
-  //  Find the file change location nearest to the mid-point of the section after break_point[1] determined above.
+  //  Proximity search and waveform check (in bands if --memory_budget was given).  With --verify we run the reference filter
+  //  first and compare.  With --sweep we just report what each set of settings would do.
 
-  break_point[2] = break_point[1] + (misc.abe_share->point_cloud_count - break_point[1]) / 2;
-  before = after = 0;
+  int32_t mismatch = 0;
 
-  for (int32_t i = break_point[2] ; i < misc.abe_share->point_cloud_count - 1 ; i++)
+  if (sweep_file[0])
     {
-      if (sa[i + 1].pfm_file != sa[i].pfm_file)
-        {
-          after = i + 1;
-          break;
-        }
+      if (!sweep_filter (&misc, sweep_file, progname)) mismatch = -1;
     }
-
-
-  for (int32_t i = break_point[2] ; i > break_point[1] ; i--)
+  else if (verify)
     {
-      if (sa[i].pfm_file != sa[i - 1].pfm_file)
-        {
-          before = i;
-          break;
-        }
-    }
+      mismatch = verify_filter (&misc, progname);
 
-  if (after - break_point[2] < break_point[2] - before)
-    {
-      break_point[2] = after;
-    }
-  else
-    {
-      break_point[2] = before;
+      if (!mismatch) fprintf (stderr, "%s - verify: all %d points match the reference filter\n", progname, misc.abe_share->point_cloud_count);
     }
 
-  fprintf (stderr,"%s %s %d %d %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,before,after,misc.abe_share->point_cloud_count,misc.data[before].file,misc.data[after].file,break_point[2]);
-  */
-
-
-  //  Do the low slope filter on all the data points.
-
-  fp = NULL;
-  wfp = NULL;
-  int32_t prev_pfm_file = -999;
-
-  for (int32_t i = 0 ; i < misc.abe_share->point_cloud_count ; i++)
+  if (mismatch < 0 || (!verify && !sweep_file[0] && !filter_area (&misc, progname)))
     {
-      //  This is the misc.data record number from the pfm/file/rec sorted array.
-
-      int32_t ndx = sa[i].rec;
-
-
-      //  Only on PFM_HOF_CHARTS_DATA.
-
-      if (misc.data[ndx].type == PFM_CHARTS_HOF_DATA)
-        {
-          //  Since we sorted by PFM file combined with the file number, we only have to close and open a new file when the pfm_file number changes.
-
-          if (sa[i].pfm_file != prev_pfm_file)
-            {
-              //  If previous HOF and/or INH (wave) files were open, close them.
-
-              if (fp) fclose (fp);
-              if (wfp) fclose (wfp);
-              fp = NULL;
-              wfp = NULL;
-
-
-              //  Get the HOF file name from the PFM list (.ctl) file.
-
-              int16_t type;
-              read_list_file (misc.pfm_handle[misc.data[ndx].pfm], misc.data[ndx].file, string, &type);
-
-
-              //  Open the HOF file.
-
-              if ((fp = open_hof_file (string)) == NULL)
-                {
-                  perror (string);
-
-                  misc.dataShare->unlock ();
-                  misc.dataShare->detach ();
-                  misc.abeShare->detach ();
-
-                  exit (-1);
-                }
-
-              hof_read_header (fp, &hof_header);
-
-
-              //  Construct the INH file name
+      if (!misc.progressive) misc.dataShare->unlock ();
+      misc.dataShare->detach ();
+      misc.abeShare->detach ();
 
-              strcpy (wave_file, string);
-              sprintf (&wave_file[strlen (wave_file) - 4], ".inh");
-
-
-              //  Open the INH file
-
-              if ((wfp = open_wave_file (wave_file)) == NULL) 
-                {
-                  perror (wave_file);
-
-                  misc.dataShare->unlock ();
-                  misc.dataShare->detach ();
-                  misc.abeShare->detach ();
-
-                  exit (-1);
-                }
-
-
-              //  Read the INH header
-
-              wave_read_header (wfp, &wave_header);
-
-              //fprintf(stderr,"%s %s %d %d %d %d %d\n",NVFFL,wave_header.ac_zero_offset[0],wave_header.ac_zero_offset[1],wave_header.ac_zero_offset[2],wave_header.ac_zero_offset[3]);
-
-              pmt_ac_zero_offset = wave_header.ac_zero_offset[PMT];
-              apd_ac_zero_offset = wave_header.ac_zero_offset[APD];
-
-
-              //  We're assuming that the waveform sizes are constant.  This error should never happen.
-
-              if (wave_header.apd_size != HWF_APD_SIZE || wave_header.pmt_size != HWF_PMT_SIZE)
-                {
-                  fprintf (stderr, "%s %s %s %d - Bad APD (%d) or PMT (%d) array length in file %s\n", progname, __FILE__, __FUNCTION__, __LINE__,
-                           wave_header.apd_size, wave_header.pmt_size, wave_file);
-
-                  misc.dataShare->unlock ();
-                  misc.dataShare->detach ();
-                  misc.abeShare->detach ();
-
-                  exit (-1);
-                }
-
-
-              //  Save the previous pfm_file number so we'll know when to open a new file.
-
-              prev_pfm_file = sa[i].pfm_file;
-            }
-
-
-          //  We want to store X and Y as meters from the lower left corner of the total MBR so that we can do our
-          //  distance calculations more quickly.
-
-          geo_distance (misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.min_y, misc.data[ndx].x, &wave_data[ndx].mx);
-          //invgp (NV_A0, NV_B0, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.min_y, misc.data[ndx].x, &dist, &az);
-          //wave_data[ndx].mx = dist;
-          geo_distance (misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.data[ndx].y, misc.abe_share->edit_area.min_x, &wave_data[ndx].my);
-          //invgp (NV_A0, NV_B0, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.data[ndx].y, misc.abe_share->edit_area.min_x, &dist, &az);
-          //wave_data[ndx].my = dist;
-
-
-          //  Set all of the check flags to NVTrue.  We'll unset them as we go along.
-
-          wave_data[ndx].check = NVTrue;
-
-
-          //  No point in checking already invalid data.
-
-          if (misc.data[ndx].val & PFM_INVAL)
-            {
-              wave_data[ndx].check = NVFalse;
-            }
-          else
-            {
-              //  Read the current HOF record.
-
-              hof_read_record (fp, misc.data[ndx].rec, &hof_record);
-
-
-              //  No point in checking Shallow Water Algorithm, Shoreline Depth Swapped data, or land.  We still have to load the wave form data though.
-
-              if ((misc.data[ndx].sub == 0 && (hof_record.abdc == 72 || hof_record.abdc == 74 || hof_record.abdc == 70)) ||
-                  (misc.data[ndx].sub == 1 && (hof_record.sec_abdc == 72 || hof_record.sec_abdc == 74 || hof_record.sec_abdc == 70)))
-                wave_data[ndx].check = NVFalse;
-
-
-              apd_run_req = hof_record.calc_bot_run_required[0];
-              pmt_run_req = hof_record.calc_bot_run_required[1];
-
-
-              wave_data[ndx].bot_bin_first = hof_record.bot_bin_first;
-              wave_data[ndx].bot_bin_second = hof_record.bot_bin_second;
-
-              if (wfp)
-                {
-                  //  Read the corresponding wave data.
-
-                  wave_read_record (wfp, misc.data[ndx].rec, &wave_rec);
-
-
-                  //  Copy the waveform data to our internal arrays.
-
-                  memcpy (wave_data[ndx].apd, wave_rec.apd, HWF_APD_SIZE);
-                  memcpy (wave_data[ndx].pmt, wave_rec.pmt, HWF_PMT_SIZE);
-
-
-                  //  Check to see if the sub_record we're looking for is PMT (0).
-
-                  if ((misc.data[ndx].sub == 0 && hof_record.bot_channel == PMT) || (misc.data[ndx].sub == 1 && hof_record.sec_bot_chan == PMT))
-                    {
-		      if (pmt_return_filter (misc.data[ndx].rec, misc.data[ndx].sub, &hof_record, pmt_run_req, slope_req, pmt_ac_zero_offset,
-					     misc.abe_share->filterShare.pmt_ac_zero_offset_required, &wave_rec)) misc.data[ndx].exflag = NVTrue;
-                    }
-
-
-                  //  Check to see if the sub_record we're looking for is APD (1).
-
-                  if ((misc.data[ndx].sub == 0 && hof_record.bot_channel == APD) || (misc.data[ndx].sub == 1 && hof_record.sec_bot_chan == APD))
-                    {
-		      if (apd_return_filter (misc.data[ndx].rec, misc.data[ndx].sub, &hof_record, apd_run_req, slope_req, apd_ac_zero_offset, 
-					     misc.abe_share->filterShare.apd_ac_zero_offset_required, &wave_rec)) misc.data[ndx].exflag = NVTrue;
-                    }
-                }
-            }
-        }
-    }
-
-
-  for (int32_t pfm = 0 ; pfm < misc.abe_share->pfm_count ; pfm++) close_pfm_file (misc.pfm_handle[pfm]);
-
-  if (fp) fclose (fp);
-  if (wfp) fclose (wfp);
-
-
-  free (sa);
-
-
-  //  Now we need to build an array of bins (twice the size of the search radius) so that we can efficiently perform the dreaded
-  //  Hockey Puck of Confidence (TM) proximity valid point search.
-
-  double search_bin_size_meters = misc.abe_share->filterShare.search_radius * 2.0;
-  double width_meters, height_meters;
-
-
-  geo_distance (misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.max_y, misc.abe_share->edit_area.min_x, &height_meters);
-  //invgp (NV_A0, NV_B0, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.max_y, misc.abe_share->edit_area.min_x, &dist, &az);
-  //height_meters = dist;
-  geo_distance (misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.max_x, &width_meters);
-  //invgp (NV_A0, NV_B0, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.min_x, misc.abe_share->edit_area.min_y, misc.abe_share->edit_area.max_x, &dist, &az);
-  //width_meters = dist;
-
-
-  int32_t rows = (int32_t) (height_meters / search_bin_size_meters) + 1;
-  int32_t cols = (int32_t) (width_meters / search_bin_size_meters) + 1;
-
-  BIN_DATA **bin_data = (BIN_DATA **) calloc (rows, sizeof (BIN_DATA *));
-  if (bin_data == NULL)
-    {
-      perror ("Allocating bin_data in hofWaveFilter.cpp");
-      misc.dataShare->unlock ();
       exit (-1);
     }
 
-  for (int32_t i = 0 ; i < rows ; i++)
-    {
-      bin_data[i] = (BIN_DATA *) calloc (cols, sizeof (BIN_DATA));
-      if (bin_data[i] == NULL)
-        {
-          perror ("Allocating bin_data[i] in hofWaveFilter.cpp");
-          misc.dataShare->unlock ();
-          exit (-1);
-        }
-    }
-
-
-  //  Now let's load the record pointers into the bin array.
-
-  for (int32_t i = 0 ; i < misc.abe_share->point_cloud_count ; i++)
-    {
-      int32_t row = (int32_t) (wave_data[i].my / search_bin_size_meters);
-      int32_t col = (int32_t) (wave_data[i].mx / search_bin_size_meters);
-
-      bin_data[row][col].data = (int32_t *) realloc (bin_data[row][col].data, (bin_data[row][col].count + 1) * sizeof (int32_t));
-      if (bin_data[row][col].data == NULL)
-        {
-          perror ("Allocating bin_data[row][col].data in hofWaveFilter.cpp");
-          misc.dataShare->unlock ();
-          exit (-1);
-        }
-
-      bin_data[row][col].data[bin_data[row][col].count] = i;
-      bin_data[row][col].count++;
-    }
 
+  for (int32_t pfm = 0 ; pfm < misc.abe_share->pfm_count ; pfm++) close_pfm_file (misc.pfm_handle[pfm]);
 
-  //  Determine which points need to have their waveforms evaluated.  This uses the dreaded Hockey Puck of Confidence (TM).  We only want
-  //  to search in one bin around the current bin.  This means we'll search 9 total bins and that should give us enough nearby data for
-  //  any point in the center bin.
 
-  for (int32_t i = 0 ; i < rows ; i++)
+  if (misc.stats)
     {
-      //  Compute the start and end Y bins for the 9 bin block.
-
-      int32_t start_y = qMax (0, i - 1);
-      int32_t end_y = qMin (rows - 1, i + 1);
-
-      for (int32_t j = 0 ; j < cols ; j++)
-        {
-          //  No point in checking if we have no data points in the bin.
-
-          if (bin_data[i][j].count)
-            {
-              //  Compute the start and end X bins for the 9 bin block.
-
-              int32_t start_x = qMax (0, j - 1);
-              int32_t end_x = qMin (cols - 1, j + 1);
-
-
-              //  Loop through the current bin checking against all points in any of the 9 bins.
-
-              for (int32_t k = 0 ; k < bin_data[i][j].count ; k++)
-                {
-                  int32_t ndx = bin_data[i][j].data[k];
-
-
-                  //  If we've already determined that this point doesn't need to be checked we can move on.
+      fprintf (stderr, "%s - %d points, %d bands, %d binned, %d bins, %d waveform checks, %d waveforms loaded\n", progname,
+               misc.abe_share->point_cloud_count, misc.bands, misc.binned, misc.bins, misc.checks, misc.loaded);
 
-                  if (wave_data[ndx].check)
-                    {
-                      uint8_t only_one_line = NVTrue;
+      fprintf (stderr, "%s - search bin split", progname);
+      for (int32_t i = 1 ; i <= HWF_MAX_SPLIT ; i++) fprintf (stderr, " %dx%d: %d bands", i, i, misc.split_bands[i]);
+      fprintf (stderr, ", at most %d threads\n", misc.threads);
 
+      for (int32_t i = 0 ; i < misc.threads ; i++)
+        fprintf (stderr, "%s - thread %-2d busy %12.3f ms, %d tasks, %d steals\n", progname, i, (double) misc.busy_ns[i] / 1.0e6,
+                 misc.tasks[i], misc.steals[i]);
 
-                      //  Y bin block loop.
+      fprintf (stderr, "%s - %" PRId64 " HOF records read, %" PRId64 " INH records read\n", progname, misc.hof_reads, misc.wave_reads);
 
-                      for (int32_t m = start_y ; m <= end_y ; m++)
-                        {
-                          //  X bin block loop.
+      if (misc.io_depth)
+        fprintf (stderr, "%s - read ahead %" PRId64 " records, depth %d\n", progname, misc.io_reads, misc.io_depth);
 
-                          for (int32_t n = start_x ; n <= end_x ; n++)
-                            {
-                              //  No point in checking empty bins.
+      fprintf (stderr, "%s - return filter %" PRId64 " returns in batches of %d, %" PRId64 " finished one at a time\n", progname,
+               misc.batch_lanes, HWF_BATCH_LANES, misc.batch_scalar);
 
-                              if (bin_data[m][n].count)
-                                {
-                                  //  Loop though all points in the bin.
+      fprintf (stderr, "%s - working memory peak %.1f MB\n", progname, (double) misc.arena.peak / 1048576.0);
 
-                                  for (int32_t p = 0 ; p < bin_data[m][n].count ; p++)
-                                    {
-                                      int32_t indx = bin_data[m][n].data[p];
+      if (misc.compress)
+        fprintf (stderr, "%s - waveform pool %" PRId64 " blocks read, %" PRId64 " decoded\n", progname, misc.block_reads, misc.block_decodes);
 
-
-                                      //  Don't check against itself and don't check against invalid data.
-
-                                      if ((m != i || n != j || ndx != indx) && !(misc.data[indx].val & PFM_INVAL) && !misc.data[indx].exflag)
-                                        {
-                                          //  If the points are in the same line we don't check them.
-
-                                          if (misc.data[ndx].line != misc.data[indx].line)
-                                            {
-                                              //  Simple check for exceeding distance in X or Y direction (prior to a radius check).
-
-                                              double diff_x = fabs (wave_data[ndx].mx - wave_data[indx].mx);
-                                              double diff_y = fabs (wave_data[ndx].my - wave_data[indx].my);
-
-                                              double dist = misc.abe_share->filterShare.search_radius + misc.data[ndx].herr + misc.data[indx].herr;
-
-                                              if (diff_x <= dist && diff_y <= dist)
-                                                {
-                                                  //  Next check the distance.  If we're within this distance, the point is valid, and it's from a different file
-                                                  //  we don't need to check either of these points.
-
-                                                  if (sqrt (diff_x * diff_x + diff_y * diff_y) <= dist)
-                                                    {
-                                                      only_one_line = NVFalse;
-
-
-                                                      //  Finally we check the Z difference.
-
-                                                      if (fabs (misc.data[ndx].z - misc.data[indx].z) < ((misc.data[ndx].verr + misc.data[indx].verr) / 2.0))
-                                                        {
-                                                          wave_data[ndx].check = wave_data[indx].check = NVFalse;
-                                                          break;
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-
-
-                      //  If there was only data from a single line within the radius we're not going to try to filter this point.
-                      //  That is a job for the analyst.
-
-                      if (only_one_line) wave_data[ndx].check = NVFalse;
-                    }
-                }
-            }
-        }
+      for (int32_t i = 0 ; i < HWF_STAGES ; i++)
+        fprintf (stderr, "%s - %-28s %12.3f ms\n", progname, stage_name[i], (double) misc.stage_ns[i] / 1.0e6);
     }
 
 
-  //  Initialize the memory location and count.
+  //  Nobody is going to see the results of a replay so we just say how many points were killed.
 
-  misc.points = NULL;
-  misc.point_count = 0;
-
-
-  //  Now let's do the waveform check on those points that need it.  We only want to search in one bin around the current bin.  This means
-  //  we'll search 9 total bins and that should give us enough nearby data for any point in the center bin.
-
-  for (int32_t i = 0 ; i < rows ; i++)
+  if (replay_file[0])
     {
-      //  Compute the start and end Y bins for the 9 bin block.
-
-      int32_t start_y = qMax (0, i - 1);
-      int32_t end_y = qMin (rows - 1, i + 1);
-
-      for (int32_t j = 0 ; j < cols ; j++)
-        {
-          //  No point in checking if we have no data points in the bin.
-
-          if (bin_data[i][j].count)
-            {
-              //  Compute the start and end X bins for the 9 bin block.
-
-              int32_t start_x = qMax (0, j - 1);
-              int32_t end_x = qMin (cols - 1, j + 1);
-
-
-              //  Loop through the current bin checking against all points in any of the 9 bins.
-
-              for (int32_t k = 0 ; k < bin_data[i][j].count ; k++)
-                {
-                  int32_t ndx = bin_data[i][j].data[k];
-
-
-                  //  If we've already determined that this point doesn't need to be checked we can move on.
-
-                  if (wave_data[ndx].check)
-                    {
-                      //  Y bin block loop.
-
-                      for (int32_t m = start_y ; m <= end_y ; m++)
-                        {
-                          //  X bin block loop.
-
-                          for (int32_t n = start_x ; n <= end_x ; n++)
-                            {
-
-                              //  No point in checking empty bins.
-
-                              if (bin_data[m][n].count)
-                                {
-                                  //  Loop though all points in the bin.
-
-                                  for (int32_t p = 0 ; p < bin_data[m][n].count ; p++)
-                                    {
-                                      int32_t indx = bin_data[m][n].data[p];
-
-
-                                      //  Don't check against itself and don't check against invalid data.
-
-                                      if ((m != i || n != j || ndx != indx) && !(misc.data[indx].val & PFM_INVAL) && !misc.data[indx].exflag)
-                                        {
-                                          //  If the points are in the same line we don't check them.
-
-                                          if (misc.data[ndx].line != misc.data[indx].line)
-                                            {
-                                              //  Simple check for exceeding distance in X or Y direction (prior to a radius check).
-
-                                              double diff_x = fabs (wave_data[ndx].mx - wave_data[indx].mx);
-                                              double diff_y = fabs (wave_data[ndx].my - wave_data[indx].my);
+      int32_t killed = 0;
 
-                                              double dist = misc.abe_share->filterShare.search_radius + misc.data[ndx].herr + misc.data[indx].herr;
+      for (int32_t i = 0 ; i < misc.abe_share->point_cloud_count ; i++) if (misc.data[i].exflag) killed++;
 
-                                              if (diff_x <= dist && diff_y <= dist)
-                                                {
-                                                  //  Next check the distance.  If we're within this distance, the point is valid, and it's from a different file
-                                                  //  we don't need to check either of these points.
-
-                                                  if (sqrt (diff_x * diff_x + diff_y * diff_y) <= dist)
-                                                    {
-                                                      if ((misc.points = (int32_t *) realloc (misc.points, (misc.point_count + 1) * sizeof (int32_t))) == NULL)
-                                                        {
-                                                          perror ("Allocating points memory in hofWaveFilter.cpp");
-                                                          misc.dataShare->unlock ();
-                                                          exit (-1);
-                                                        }
-
-                                                      misc.points[misc.point_count] = indx;
-                                                      misc.point_count++;
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-
-
-                      //  Now we have to look at the waveforms for all of the points in the search radius.
-
-                      if (waveform_check (&misc, wave_data, ndx))
-                        {
-                          //  No supporting waveforms.
-
-                          misc.data[ndx].exflag = NVTrue;
-                        }
-
-
-                      //  Free the point memory to prepare for the next point.
-
-                      if (misc.point_count)
-                        {
-                          free (misc.points);
-                          misc.points = NULL;
-                          misc.point_count = 0;
-                        }
-                    }
-                }
-            }
-        }
+      fprintf (stderr, "%s - replay: %d of %d points flagged\n", progname, killed, misc.abe_share->point_cloud_count);
     }
 
 
-  //  Free all of the memory we allocated.
+  //  Lock shared memory while we're modifying things.  A sweep doesn't change any points so there's nothing for pfmEdit(3D) to
+  //  pick up.
 
-  for (int32_t i = 0 ; i < rows ; i++)
+  if (!sweep_file[0])
     {
-      for (int32_t j = 0 ; j < cols ; j++)
-        {
-          if (bin_data[i][j].count) free (bin_data[i][j].data);
-        }
-      free (bin_data[i]);
-    }
-  free (bin_data);
-
-  free (wave_data);
+      misc.abeShare->lock ();
 
+      misc.abe_share->modcode = (misc.progressive && misc.partial) ? (PFM_CHARTS_HOF_DATA | HWF_MODCODE_PARTIAL) : PFM_CHARTS_HOF_DATA;
 
-  //  Lock shared memory while we're modifying things.
+      misc.abeShare->unlock ();
+    }
 
-  misc.abeShare->lock ();
 
-  misc.abe_share->modcode = PFM_CHARTS_HOF_DATA;
+  //  Unlock the data shared memory area.
 
-  misc.abeShare->unlock ();
+  if (!misc.progressive) misc.dataShare->unlock ();
 
 
-  //  Unlock the data shared memory area.
+  //  Write the decision trace (after letting pfmEdit(3D) go since this can take a moment).
 
-  misc.dataShare->unlock ();
+  if (misc.trace) trace_dump (&misc, trace_file);
 
 
   //  Detach shared memory.
 
   misc.dataShare->detach ();
   misc.abeShare->detach ();
+
+
+  if (mismatch) exit (-1);
 }
 
 
@@ -46,8 +46,6 @@ protected:
 
   MISC            misc;
 
-  WAVE_DATA       *wave_data;
-
   char            progname[256];
 
 
@@ -17,6 +17,26 @@ INCLUDEPATH += .
 # Input
 HEADERS += hofWaveFilter.hpp hofWaveFilterDef.hpp version.hpp
 SOURCES += apd_return_filter.cpp \
+           arena.cpp \
+           bin_grid.cpp \
+           capture.cpp \
+           filter_area.cpp \
+           filter_band.cpp \
+           find_first_drop.cpp \
            hofWaveFilter.cpp \
+           ingest_points.cpp \
+           load_waveforms.cpp \
+           neighbor_mask.cpp \
            pmt_return_filter.cpp \
-           waveform_check.cpp
+           reference_filter.cpp \
+           return_filter_batch.cpp \
+           shot_io.cpp \
+           shot_prefetch.cpp \
+           sort_records.cpp \
+           sweep.cpp \
+           trace.cpp \
+           tune.cpp \
+           verify.cpp \
+           waveform_check.cpp \
+           waveform_pool.cpp \
+           work_pool.cpp
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <inttypes.h>
 #include <getopt.h>
 
 
@@ -57,25 +58,358 @@ typedef struct
 } SORT_REC;
 
 
+//  The per point data.  The proximity search and the waveform check work on one band of bin rows at a time (the whole area
+//  is one band unless --memory_budget is used) so this is only allocated for the points in the band.  ndx is the point's
+//  index in misc.data.  The entries are in misc.data order.
+
 typedef struct
 {
+  int32_t     ndx;                       //  misc.data index
   double      mx;                        //  X position in meters
   double      my;                        //  Y position in meters
   uint8_t     check;                     //  Set if we need to check adjacent waveforms (e.g. this is an isolated point)
+  uint8_t     killed;                    //  Set if the point was already killed (or was killed by the return filter)
   int32_t     bot_bin_first;
   int32_t     bot_bin_second;
+  int32_t     wave;                      //  Index of this point's waveform in the waveform pool (-1 if it hasn't been loaded)
+} WAVE_DATA;
+
+
+//  What ingest_points found for each point, saved so that points that are in more than one band (because of the extra rows
+//  around each band) only have to be read once.  Only used when the area is done in bands.
+
+typedef struct
+{
+  int16_t     bot_bin_first;
+  int16_t     bot_bin_second;
+  uint8_t     flags;                     //  HWF_INGESTED, HWF_CHECK, HWF_KILLED
+} POINT_STATE;
+
+
+//  Progressive filtering (--time_budget, --priority_area, see filter_area.cpp).  Without --memory_budget the area is split
+//  into about HWF_PROGRESS_BANDS bands so there is something to publish along the way.  Only with those options, while
+//  results are being published and at the end if the time budget ran out first, ABE_SHARE.modcode is PFM_CHARTS_HOF_DATA
+//  with HWF_MODCODE_PARTIAL set.
+
+#define HWF_PROGRESS_BANDS    16
+#define HWF_MODCODE_PARTIAL   0x40000000
+
+
+//  Bit sets (one bit per point, packed into 64 bit words).  The per point yes/no state that the waveform check looks at for
+//  every neighbor is kept in these instead of in the big per point structures.
+
+#define HWF_BIT_WORDS(n)    (((n) + 63) >> 6)
+#define HWF_BIT_TEST(b, i)  (((b)[(i) >> 6] >> ((i) & 63)) & 1)
+#define HWF_BIT_SET(b, i)   ((b)[(i) >> 6] |= (uint64_t) 1 << ((i) & 63))
+
+
+//  Waveforms are only kept for the points that the waveform check actually looks at (the cross-line neighbors of
+//  isolated points).  See load_waveforms.cpp.
+
+typedef struct
+{
   uint8_t     apd[HWF_APD_SIZE];
   uint8_t     pmt[HWF_PMT_SIZE];
-} WAVE_DATA;
+} WAVEFORM;
+
+
+//  With the --compress_waveforms option the waveform pool is stored compressed (see waveform_pool.cpp).  Each waveform is
+//  split into blocks of HWF_BLOCK_SIZE samples (APD blocks first, then PMT blocks) and each block is delta and run length
+//  coded on its own so that we only have to decode the blocks that the waveform check's search window touches.
+
+#define HWF_BLOCK_SIZE   64
+#define HWF_APD_BLOCKS   ((HWF_APD_SIZE + HWF_BLOCK_SIZE - 1) / HWF_BLOCK_SIZE)
+#define HWF_PMT_BLOCKS   ((HWF_PMT_SIZE + HWF_BLOCK_SIZE - 1) / HWF_BLOCK_SIZE)
+#define HWF_WAVE_BLOCKS  (HWF_APD_BLOCKS + HWF_PMT_BLOCKS)
+#define HWF_CACHE_SIZE   4096            //  Decoded block cache entries (must be a power of 2)
+
+#define HWF_APD          0
+#define HWF_PMT          1
+
+typedef struct
+{
+  int64_t     offset;                    //  Offset of the first block in the packed byte pool
+  uint8_t     length[HWF_WAVE_BLOCKS];   //  Packed length of each block
+} PACKED_WAVEFORM;
+
+typedef struct
+{
+  int64_t     key;                       //  slot * HWF_WAVE_BLOCKS + block (-1 if empty)
+  uint8_t     sample[HWF_BLOCK_SIZE];
+} WAVE_BLOCK;
+
+
+//  The proximity search bins are only allocated for bins that actually have points in them.  The occupied bins are
+//  sorted along a Morton (Z order) curve so that the 9 bin blocks of bins that are next to each other in the list are
+//  mostly in the same part of memory.  All of the point indices are stored end to end in BIN_GRID.data.  Within each
+//  bin the points are grouped by line (in point order within each line) so that the searches can skip a point's own
+//  line in one step.  See bin_grid.cpp.
+//
+//  The search bins (twice the search radius) can be split into BIN_GRID.split by BIN_GRID.split cells.  The searches still
+//  only look in the 9 search bin block around a point (that's what decides which points are neighbors) but they can skip
+//  the cells in the block that are too far away to hold a neighbor.  The split is picked for each band by tune_band
+//  (tune.cpp) unless --cell_split is used.
+
+#define HWF_MAX_SPLIT    4
+#define HWF_MAX_STENCIL  (9 * HWF_MAX_SPLIT * HWF_MAX_SPLIT)
+
+typedef struct
+{
+  int32_t     line;                      //  Line number
+  int32_t     start;                     //  Index of the first point of this line in BIN_GRID.data
+  int32_t     count;                     //  Number of points from this line in the bin
+} BIN_LINE;
 
 
 typedef struct
 {
-  int32_t     count;
-  int32_t     *data;
+  uint64_t    key;                       //  Morton code of row and col
+  int32_t     row;                       //  Cell row
+  int32_t     col;                       //  Cell column
+  int32_t     crow;                      //  Search bin row (the cell is always completely inside this search bin)
+  int32_t     ccol;                      //  Search bin column
+  float       herr_max;                  //  Largest horizontal error of the points in the cell
+  int32_t     start;                     //  Index of the first point of this bin in BIN_GRID.data
+  int32_t     count;                     //  Number of points in this bin
+  int32_t     line_start;                //  Index of the first line of this bin in BIN_GRID.line
+  int32_t     line_count;                //  Number of lines in this bin
+  int32_t     usable_line;               //  Line of all of the usable points in the bin (or HWF_NO_LINE, HWF_MIXED_LINES)
 } BIN_DATA;
 
 
+//  BIN_DATA.usable_line for a bin with no usable points or with usable points from more than one line.  The isolation pass
+//  combines these over a cell's stencil so that a point with no other line anywhere near it is settled without looking at
+//  any of the neighbor points.
+
+#define HWF_NO_LINE      -1
+#define HWF_MIXED_LINES  -2
+
+
+//  Flags for BIN_GRID.flags.
+
+#define HWF_USABLE    0x01               //  Valid and not killed (may be used as a neighbor)
+#define HWF_CHECK     0x02               //  Still needs to be checked
+#define HWF_KILLED    0x04               //  Killed by the return filter
+#define HWF_INGESTED  0x08               //  Already read (POINT_STATE only)
+
+
+//  Padding for the single precision distance prefilter (neighbor_mask).  The limit is scaled by HWF_MASK_SCALE and
+//  then BIN_GRID.slack (HWF_MASK_SLACK times the search bin size) is added.  Float rounding of cell relative coordinates
+//  that are less than two search bins apart is several orders of magnitude smaller than this so no point that passes
+//  the double precision test can be dropped by the prefilter.
+
+#define HWF_MASK_SCALE  1.0001f
+#define HWF_MASK_SLACK  1.0e-4
+
+
+//  Everything the proximity passes look at is copied out of POINT_CLOUD and WAVE_DATA into these columns (in
+//  BIN_GRID.data order) so that the passes don't have to drag whole records through the cache.
+
+typedef struct
+{
+  double      search_bin_size;           //  Search bin size in meters (twice the search radius)
+  int32_t     split;                     //  Cells per search bin in each direction
+  double      bin_size;                  //  Cell size in meters (search_bin_size / split)
+  int32_t     reach;                     //  Cells on either side of a cell that can hold a neighbor of one of its points
+  float       slack;                     //  Absolute padding for neighbor_mask (HWF_MASK_SLACK * search_bin_size)
+  int32_t     bin_count;                 //  Number of occupied bins
+  BIN_DATA    *bin;                      //  Occupied bins
+  int32_t     line_count;                //  Total number of line groups in all bins
+  BIN_LINE    *line;                     //  Line groups
+  int32_t     count;                     //  Number of binned points
+  int32_t     *data;                     //  wave_data indices of the binned points, grouped by bin and line
+  double      *mx;                       //  X position in meters
+  double      *my;                       //  Y position in meters
+  float       *lx;                       //  X position relative to the lower left corner of the point's cell
+  float       *ly;                       //  Y position relative to the lower left corner of the point's cell
+  float       *z;                        //  Same precision as POINT_CLOUD
+  float       *herr;
+  float       *verr;
+  int32_t     *line_num;                 //  Line number
+  uint8_t     *flags;                    //  HWF_USABLE, HWF_CHECK, HWF_KILLED
+} BIN_GRID;
+
+
+//  A point that needs the waveform check and the range of its neighbors in the neighbor list.
+
+typedef struct
+{
+  int32_t     ndx;                       //  wave_data index
+  int32_t     row;                       //  Bin row
+  int32_t     col;                       //  Bin column
+  int32_t     start;                     //  Index of the first neighbor in the neighbor list
+  int32_t     count;                     //  Number of neighbors
+} CANDIDATE;
+
+
+//  Stages for the --stats option.
+
+#define HWF_STAGES    6
+
+
+//  Worker pool (see run_pool).  A task function is called once for each task number with the number of the thread running
+//  it (0 through threads - 1, thread 0 is the calling thread).
+
+#define HWF_MAX_THREADS  64
+
+typedef void (*POOL_TASK) (void *data, int32_t thread, int32_t task);
+
+
+//  Decision trace (--trace).  Each thread has its own ring buffer of HWF_TRACE_SIZE records (the oldest records are
+//  overwritten when it fills up) so recording a decision is just a store.  The rings are written to the trace file when
+//  we're done and can be printed with --decode_trace (see trace.cpp).  When tracing is off the filters are handed a NULL
+//  TRACE_REC pointer and the only cost is the test for it.
+
+#define HWF_TRACE_SIZE      1048576      //  Records per thread (must be a power of 2)
+#define HWF_TRACE_VERSION   1
+
+#define HWF_NO_CHANNEL      255
+
+#define HWF_RULE_AC_OFFSET  1            //  Return filter - bottom bin under the AC zero offset requirement
+#define HWF_RULE_SURFACE    2            //  Return filter - bottom bin before the first drop (surface)
+#define HWF_RULE_RUN        3            //  Return filter - rise to the bottom return too short
+#define HWF_RULE_SLOPE      4            //  Return filter - rise to the bottom return too shallow
+#define HWF_RULE_ONE_LINE   5            //  Proximity search - only one line within the search radius (left for the analyst)
+#define HWF_RULE_ISOLATION  6            //  Proximity search - no depth consistent neighbor from another line
+#define HWF_RULE_NO_RISE    7            //  Waveform check - no neighbor waveform rises near the bottom bin
+#define HWF_RULE_RISE       8            //  Waveform check - supported by a rising neighbor waveform
+#define HWF_RULES           9
+
+typedef struct
+{
+  int32_t     ndx;                       //  misc.data index
+  uint8_t     rule;                      //  HWF_RULE_*
+  uint8_t     killed;                    //  Set if the rule killed the point
+  uint8_t     channel;                   //  HWF_APD, HWF_PMT, or HWF_NO_CHANNEL
+  uint8_t     pad;
+  int16_t     bin;                       //  Waveform bin the rule looked at (bottom bin or first drop)
+  int16_t     run;                       //  Run length (return filter) or rise count (waveform check)
+  int32_t     count;                     //  Number of neighbors
+  float       slope;                     //  Slope (return filter)
+} TRACE_REC;
+
+typedef struct
+{
+  TRACE_REC   *rec;                      //  HWF_TRACE_SIZE records
+  int64_t     total;                     //  Number of records ever written (the ring holds the last HWF_TRACE_SIZE)
+} TRACE_RING;
+
+
+//  Batched return filter (see return_filter_batch.cpp).  The returns that need the return filter are collected one per lane
+//  (a batch per channel) and run through the filter HWF_BATCH_LANES at a time.
+
+#define HWF_BATCH_LANES     32           //  Returns per batch (one byte each in an AVX2 register)
+#define HWF_BATCH_BACK      64           //  Bins before the bottom bin that the run start scan looks at in the lanes
+#define HWF_BATCH_AHEAD     50           //  Bins from the bottom bin that the peak scan looks at (same as the return filters)
+
+typedef struct
+{
+  int32_t     k;                         //  wave_data index
+  int32_t     ndx;                       //  misc->data index
+  int32_t     rec;                       //  Record number
+  int32_t     sub;                       //  Sub record (0 is primary, 1 is secondary)
+  int32_t     bin;                       //  Bottom bin of the return
+  int32_t     run_req;                   //  Run length required
+  int32_t     ac_zero_offset;            //  AC zero offset of the file
+  int32_t     same;                      //  Earlier lane with the same waveform (its surface is used) or -1
+  int32_t     surface;                   //  First drop (set by return_filter_batch)
+  uint8_t     killed;                    //  Set by return_filter_batch if the return should be killed
+  TRACE_REC   trace;                     //  Why it was killed (rule, bin, run, and slope only)
+} RETURN_LANE;
+
+typedef struct
+{
+  int32_t     channel;                   //  HWF_APD or HWF_PMT
+  int32_t     size;                      //  Number of bins in the waveforms
+  int32_t     ac_off_req;                //  AC zero offset required (0 for no check)
+  float       slope_req;                 //  Required slope
+  int32_t     count;                     //  Lanes in use
+  HYDRO_OUTPUT_T hof;                    //  Stand in HOF record for the scalar return filter (zeroed)
+  RETURN_LANE lane[HWF_BATCH_LANES];
+  uint8_t     wave[HWF_BATCH_LANES][HWF_PMT_SIZE];                         //  The waveform of each lane
+  uint8_t     row[HWF_PMT_SIZE][HWF_BATCH_LANES];                          //  The same, one row per bin
+  uint8_t     window[HWF_BATCH_BACK + HWF_BATCH_AHEAD][HWF_BATCH_LANES];   //  The bins around each lane's bottom bin
+} RETURN_BATCH;
+
+
+//  Read ahead of the HOF and INH records (see shot_prefetch.cpp).  The CHARTS readers don't tell us where the records are so
+//  the record size of each file is worked out from the file position after the first reads.
+
+#define HWF_IO_DEPTH  32                 //  Default number of records to read ahead (--io_depth)
+#define HWF_IO_SLOT   4096               //  Most bytes read ahead for one record
+
+typedef struct
+{
+  int32_t     rec;                       //  Record number of the first read (-1 until then)
+  int64_t     end;                       //  File position after the first read
+  int64_t     size;                      //  Record size (0 until two different records have been read, -1 if they aren't fixed)
+} SHOT_GEOMETRY;
+
+typedef struct SHOT_RING SHOT_RING;
+
+
+//  The HOF and INH files for one PFM/file number (see shot_io.cpp).
+
+typedef struct
+{
+  FILE        *hof_fp;                   //  HOF file (NULL if it wasn't asked for)
+  FILE        *wave_fp;                  //  INH file
+  int32_t     pmt_ac_zero_offset;
+  int32_t     apd_ac_zero_offset;
+  SHOT_GEOMETRY hof_geom;                //  HOF record layout (for read ahead)
+  SHOT_GEOMETRY wave_geom;               //  INH record layout (for read ahead)
+  int32_t     ahead;                     //  Next sort array entry to read ahead
+} SHOT_FILES;
+
+
+//  A shot for the synthetic point clouds used by --verify_synthetic (see verify.cpp), also used by --sweep to keep the real
+//  shots in memory (see sweep.cpp).  These stand in for the HOF and INH records of a point when MISC.synthetic is set.
+
+typedef struct
+{
+  int16_t     abdc;
+  int16_t     sec_abdc;
+  int16_t     bot_channel;
+  int16_t     sec_bot_chan;
+  int16_t     calc_bot_run_required[2];
+  int16_t     bot_bin_first;
+  int16_t     bot_bin_second;
+  int16_t     pmt_ac_zero_offset;
+  int16_t     apd_ac_zero_offset;
+  uint8_t     apd[HWF_APD_SIZE];
+  uint8_t     pmt[HWF_PMT_SIZE];
+} SYNTHETIC_SHOT;
+
+
+//  Working memory for a run (see arena.cpp).
+
+#define HWF_ARENA_BLOCK   (64 * 1048576) //  Smallest arena block (bytes)
+#define HWF_ARENA_BLOCKS  64             //  Most arena blocks
+
+typedef struct
+{
+  uint8_t     *base;
+  int64_t     size;
+  int64_t     used;
+  uint8_t     mapped;                    //  Set if the block was mmapped (otherwise it came from malloc)
+} ARENA_BLOCK;
+
+typedef struct
+{
+  ARENA_BLOCK block[HWF_ARENA_BLOCKS];
+  int32_t     block_count;
+  int32_t     current;                   //  Block we're allocating from (the ones after it are empty)
+  int32_t     huge_pages;                //  0 - normal pages, 1 - transparent huge pages, 2 - explicit huge pages
+  int64_t     peak;                      //  Most bytes in use
+} ARENA;
+
+typedef struct
+{
+  int32_t     block;
+  int64_t     used;
+} ARENA_MARK;
+
+
 // General stuff.
 
 typedef struct
@@ -85,11 +419,58 @@ typedef struct
   QSharedMemory *dataShare;               //  Point cloud shared memory.
   POINT_CLOUD *data;                      //  Pointer to POINT_CLOUD structure in point cloud shared memory.  To see what is in the 
                                           //  POINT_CLOUD structure please see the ABE.h file in the nvutility library.
+  uint64_t    *kill_bits;                 //  Killed points (bit set indexed by misc.data index, copied to exflag by filter_area)
   int32_t     *points;                    //  Points within the search radius
   int32_t     point_count;                //  Number of points within search radius
+  WAVEFORM    *waveform;                  //  Waveform pool (indexed by WAVE_DATA.wave)
+  int32_t     waveform_count;             //  Number of waveforms in the pool
+  uint8_t     compress;                   //  Set to keep the waveform pool compressed (--compress_waveforms)
+  PACKED_WAVEFORM *packed;                //  Compressed waveform pool (indexed by WAVE_DATA.wave)
+  uint8_t     *packed_data;               //  Packed blocks
+  int64_t     packed_size;                //  Bytes used in packed_data
+  int64_t     packed_alloc;               //  Bytes allocated for packed_data
+  WAVE_BLOCK  *block_cache;               //  Decoded block cache
+  int64_t     block_reads;                //  Number of blocks asked for
+  int64_t     block_decodes;              //  Number of blocks actually decoded
   double      radius;
   int32_t     search_width;
   int32_t     rise_threshold;
+  uint8_t     stats;                      //  Print timing and counts to stderr when done
+  int64_t     memory_budget;              //  Approximate peak memory (bytes) for the per band data (0 to do the whole area at once)
+  int32_t     time_budget;                //  Milliseconds to stop starting new bands after (--time_budget, 0 for no limit)
+  uint8_t     priority;                   //  Set if --priority_area was given
+  NV_F64_XYMBR priority_area;             //  Area to filter first (--priority_area, usually what's displayed in pfmEdit)
+  uint8_t     partial;                    //  Set by filter_area if the time budget ran out before the whole area was done
+  uint8_t     progressive;                //  Set if --time_budget or --priority_area was given (results published per band)
+  QElapsedTimer run_clock;                //  Started by filter_area, for the time budget (see out_of_time)
+  int64_t     stage_ns[HWF_STAGES];       //  Time spent in each stage (nanoseconds, all bands)
+  int32_t     bands;                      //  Number of bands
+  int32_t     binned;                     //  Points binned (all bands)
+  int32_t     bins;                       //  Occupied bins (all bands)
+  int32_t     checks;                     //  Waveform checks (all bands)
+  int32_t     loaded;                     //  Waveforms loaded (all bands)
+  int32_t     cell_split;                 //  Search bin split from --cell_split (0 to let tune_band pick it)
+  int32_t     split_bands[HWF_MAX_SPLIT + 1]; //  Number of bands done with each split
+  int32_t     threads;                    //  Most worker threads to use (--threads, or the number of processors)
+  uint8_t     auto_threads;               //  Set if --threads wasn't used (tune_band may use fewer threads for small bands)
+  int32_t     band_threads;               //  Worker threads for the current band (picked by tune_band)
+  int32_t     task_points;                //  About how many points go in each proximity pass task (picked by tune_band)
+  int64_t     busy_ns[HWF_MAX_THREADS];   //  Time each worker thread spent running tasks (nanoseconds, all bands)
+  int32_t     tasks[HWF_MAX_THREADS];     //  Tasks run by each worker thread
+  int32_t     steals[HWF_MAX_THREADS];    //  Times each worker thread stole tasks from another one
+  TRACE_RING  *trace;                     //  Decision trace rings, one per thread (NULL unless --trace)
+  int32_t     trace_threads;              //  Number of trace rings
+  SYNTHETIC_SHOT *synthetic;              //  Synthetic shots (indexed by misc.data index, NULL unless --verify_synthetic or --sweep)
+  float       slope_req;                  //  Required return filter slope (0.50 unless --sweep changes it)
+  int32_t     io_depth;                   //  Records to read ahead (--io_depth, 0 for no read ahead)
+  SHOT_RING   *io_ring;                   //  io_uring for the read ahead (NULL to use posix_fadvise instead)
+  int64_t     io_reads;                   //  Read ahead requests
+  int64_t     hof_reads;                  //  HOF records read
+  int64_t     wave_reads;                 //  INH records read
+  int64_t     batch_lanes;                //  Returns run through the batched return filter
+  int64_t     batch_scalar;               //  Returns the batched return filter had to finish one at a time
+  int32_t     huge_pages;                 //  Huge pages for the arena (--huge_pages, see arena_init)
+  ARENA       arena;                      //  Working memory for filter_area
 
 
   //  The following concern PFMs as layers.  There are a few things from ABE_SHARE that also need to be 
@@ -100,4 +481,55 @@ typedef struct
 } MISC;
 
 
+//  Function prototypes.
+
+uint8_t load_waveforms (MISC *misc, WAVE_DATA *wave_data, int32_t *list, int32_t count, char *progname);
+uint8_t build_bin_grid (MISC *misc, WAVE_DATA *wave_data, int32_t count, double search_bin_size, int32_t split, BIN_GRID *grid);
+int32_t find_bin (BIN_GRID *grid, int32_t row, int32_t col);
+uint32_t neighbor_mask (BIN_GRID *grid, int32_t start, int32_t count, float cx, float cy, float base);
+uint8_t pack_waveform (MISC *misc, int32_t slot, uint8_t *apd, uint8_t *pmt);
+uint8_t *waveform_samples (MISC *misc, int32_t slot, int32_t type, int32_t first, int32_t last, uint8_t *buffer);
+uint8_t check_waveform_packing (char *progname);
+uint8_t ingest_points (MISC *misc, WAVE_DATA *wave_data, int32_t count, POINT_STATE *state, char *progname);
+uint8_t filter_band (MISC *misc, WAVE_DATA *wave_data, int32_t count, int32_t first_row, int32_t last_row, char *progname);
+uint8_t filter_area (MISC *misc, char *progname);
+uint8_t out_of_time (MISC *misc);
+int32_t tune_band (MISC *misc, WAVE_DATA *wave_data, int32_t count, char *progname);
+uint8_t run_pool (MISC *misc, int32_t threads, int32_t task_count, POOL_TASK task, void *data);
+int32_t stencil_cells (BIN_GRID *grid, int32_t b, int32_t *stencil);
+uint8_t cell_in_reach (BIN_GRID *grid, BIN_DATA *cell, double mx, double my, double base);
+uint8_t reference_filter (MISC *misc, uint8_t *rule, char *progname);
+int32_t verify_filter (MISC *misc, char *progname);
+uint8_t verify_synthetic (MISC *misc, int32_t cases, char *progname);
+uint8_t sweep_filter (MISC *misc, char *file, char *progname);
+uint8_t capture_session (MISC *misc, char *file);
+uint8_t replay_session (char *file, int32_t *key, char *progname);
+uint8_t pmt_return_filter (int32_t rec, int32_t sub_rec, HYDRO_OUTPUT_T *hof_record, int32_t pmt_run_req, float slope_req, int32_t ac_zero_offset,
+                           int32_t ac_off_req, uint8_t *pmt, int32_t *surface, TRACE_REC *trace);
+uint8_t apd_return_filter (int32_t rec, int32_t sub_rec, HYDRO_OUTPUT_T *hof_record, int32_t apd_run_req, float slope_req, int32_t ac_zero_offset,
+                           int32_t ac_off_req, uint8_t *apd, int32_t *surface, TRACE_REC *trace);
+int32_t find_first_drop (uint8_t *wave, int32_t size);
+void sort_records (SORT_REC *sa, int32_t count, SORT_REC *temp);
+void return_filter_batch (MISC *misc, RETURN_BATCH *batch);
+uint8_t waveform_check (MISC *misc, WAVE_DATA *wave_data, int32_t recnum, TRACE_REC *trace);
+uint8_t open_shot_files (MISC *misc, int32_t ndx, uint8_t hof, SHOT_FILES *files, char *progname);
+void close_shot_files (SHOT_FILES *files);
+void read_shot_record (MISC *misc, SHOT_FILES *files, int32_t ndx, HYDRO_OUTPUT_T *hof_record);
+void read_shot_waveform (MISC *misc, SHOT_FILES *files, int32_t ndx, WAVE_DATA_T *wave_rec, uint8_t **apd, uint8_t **pmt);
+void arena_init (ARENA *arena, int32_t huge_pages);
+void *arena_alloc (ARENA *arena, int64_t bytes, uint8_t zero);
+ARENA_MARK arena_mark (ARENA *arena);
+void arena_release (ARENA *arena, ARENA_MARK mark);
+void arena_free (ARENA *arena);
+void start_prefetch (MISC *misc);
+void stop_prefetch (MISC *misc);
+void note_shot_read (SHOT_GEOMETRY *geom, FILE *fp, int32_t rec);
+void prefetch_shots (MISC *misc, SHOT_FILES *files, WAVE_DATA *wave_data, SORT_REC *sa, int32_t count, int32_t i);
+uint8_t trace_init (MISC *misc, int32_t threads);
+void trace_record (MISC *misc, int32_t thread, TRACE_REC *rec);
+uint8_t trace_dump (MISC *misc, char *file);
+void trace_free (MISC *misc);
+uint8_t decode_trace (char *file);
+
+
 #endif
@@ -0,0 +1,481 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+/*  Run the return filter on the returns in a batch and kill the ones that fail.  */
+
+static void flush_batch (MISC *misc, RETURN_BATCH *batch, WAVE_DATA *wave_data, POINT_STATE *state)
+{
+  if (!batch->count) return;
+
+  return_filter_batch (misc, batch);
+
+  for (int32_t l = 0 ; l < batch->count ; l++)
+    {
+      RETURN_LANE *lane = &batch->lane[l];
+
+      if (!lane->killed) continue;
+
+      HWF_BIT_SET (misc->kill_bits, lane->ndx);
+      wave_data[lane->k].killed = NVTrue;
+      if (state) state[lane->ndx].flags |= HWF_KILLED;
+
+      if (misc->trace)
+        {
+          lane->trace.ndx = lane->ndx;
+          lane->trace.killed = NVTrue;
+          lane->trace.channel = batch->channel;
+          lane->trace.pad = 0;
+          lane->trace.count = 0;
+          trace_record (misc, 0, &lane->trace);
+        }
+    }
+
+  batch->count = 0;
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        ingest_points                                       *
+*                                                                           *
+*   Purpose:            Read the HOF record for each point, set up the      *
+*                       per point data, and run the return filters on the   *
+*                       waveform of each point that is going to be checked. *
+*                       When state is not NULL points that were already     *
+*                       read (for an earlier band) get their saved results  *
+*                       back instead of being read again and the results    *
+*                       for newly read points are saved.  If the            *
+*                       --time_budget runs out it stops after the shot it's *
+*                       on and sets misc->partial.                          *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       wave_data      - the per point data (ndx must be    *
+*                                        set)                               *
+*                       count          - number of entries in wave_data     *
+*                       state          - saved per point results (indexed   *
+*                                        by misc->data index) or NULL       *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t ingest_points (MISC *misc, WAVE_DATA *wave_data, int32_t count, POINT_STATE *state, char *progname)
+{
+  SHOT_FILES         files;
+  HYDRO_OUTPUT_T     hof_record;
+  WAVE_DATA_T        wave_rec;
+  uint8_t            *apd = NULL, *pmt = NULL;
+  int32_t            pmt_run_req = 0, apd_run_req = 0, pmt_ac_zero_offset = 0, apd_ac_zero_offset = 0;
+  float              slope_req = misc->slope_req;
+
+
+  //  The second half of the sort array is scratch space for sort_records.
+
+  SORT_REC *sa = (SORT_REC *) arena_alloc (&misc->arena, 2 * qMax (count, 1) * sizeof (SORT_REC), NVFalse);
+  if (sa == NULL)
+    {
+      perror ("Allocating sort array in ingest_points.cpp");
+      return (NVFalse);
+    }
+
+
+  //  Stuff the record pointers into the sort array.  We also clear the check flag and waveform slot so that non-HOF points
+  //  are ignored by the proximity search.  Points that we already read for an earlier band get their saved results back.
+
+  int32_t read_count = 0;
+
+  for (int32_t k = 0 ; k < count ; k++)
+    {
+      int32_t ndx = wave_data[k].ndx;
+
+      wave_data[k].check = NVFalse;
+      wave_data[k].killed = NVFalse;
+      wave_data[k].bot_bin_first = wave_data[k].bot_bin_second = 0;
+      wave_data[k].wave = -1;
+
+      if (state && (state[ndx].flags & HWF_INGESTED))
+        {
+          geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->abe_share->edit_area.min_y, misc->data[ndx].x, &wave_data[k].mx);
+          geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->data[ndx].y, misc->abe_share->edit_area.min_x, &wave_data[k].my);
+
+          wave_data[k].check = (state[ndx].flags & HWF_CHECK) ? NVTrue : NVFalse;
+          wave_data[k].killed = (state[ndx].flags & HWF_KILLED) ? NVTrue : NVFalse;
+          wave_data[k].bot_bin_first = state[ndx].bot_bin_first;
+          wave_data[k].bot_bin_second = state[ndx].bot_bin_second;
+          continue;
+        }
+
+      sa[read_count].pfm_file = misc->data[ndx].pfm * PFM_MAX_FILES + misc->data[ndx].file;
+      sa[read_count].orig_rec = misc->data[ndx].rec;
+      sa[read_count].rec = k;
+      read_count++;
+    }
+
+
+  //  Sort the records so we can read from each file in order.
+
+  sort_records (sa, read_count, sa + qMax (count, 1));
+
+
+
+  /*  Beginning of possible multithreading (to be used in a batch version of this program).
+
+  //  We need to find 3 break points to set up the possibility of 4 threads.  First, find the pfm_file change location nearest to the center of
+  //  the sorted point cloud array.
+
+  int32_t break_point[3];
+  break_point[1] = read_count / 2;
+  int32_t after = 0, before = 0;
+
+  for (int32_t i = break_point[1] ; i < read_count - 1 ; i++)
+    {
+      if (sa[i + 1].pfm_file != sa[i].pfm_file)
+        {
+          after = i + 1;
+          break;
+        }
+    }
+
+  for (int32_t i = break_point[1] ; i > 0 ; i--)
+    {
+      if (sa[i].pfm_file != sa[i - 1].pfm_file)
+        {
+          before = i;
+          break;
+        }
+    }
+
+  if (after - break_point[1] < break_point[1] - before)
+    {
+      break_point[1] = after;
+    }
+  else
+    {
+      break_point[1] = before;
+    }
+
+  fprintf (stderr,"%s %s %d %d %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,before,after,read_count,misc->data[before].file,misc->data[after].file,break_point[1]);
+
+  //  Find the file change location nearest to the mid-point of the section prior to break_point[1] determined above.
+
+  break_point[0] = break_point[1] / 2;
+  before = after = 0;
+
+  for (int32_t i = break_point[0] ; i < break_point[1] - 1 ; i++)
+    {
+      if (sa[i + 1].pfm_file != sa[i].pfm_file)
+        {
+          after = i + 1;
+          break;
+        }
+    }
+
+
+  for (int32_t i = break_point[0] ; i > 0 ; i--)
+    {
+      if (sa[i].pfm_file != sa[i - 1].pfm_file)
+        {
+          before = i;
+          break;
+        }
+    }
+
+  if (after - break_point[0] < break_point[0] - before)
+    {
+      break_point[0] = after;
+    }
+  else
+    {
+      break_point[0] = before;
+    }
+
+  fprintf (stderr,"%s %s %d %d %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,before,after,read_count,misc->data[before].file,misc->data[after].file,break_point[0]);
+
+  //  Find the file change location nearest to the mid-point of the section after break_point[1] determined above.
+
+  break_point[2] = break_point[1] + (read_count - break_point[1]) / 2;
+  before = after = 0;
+
+  for (int32_t i = break_point[2] ; i < read_count - 1 ; i++)
+    {
+      if (sa[i + 1].pfm_file != sa[i].pfm_file)
+        {
+          after = i + 1;
+          break;
+        }
+    }
+
+
+  for (int32_t i = break_point[2] ; i > break_point[1] ; i--)
+    {
+      if (sa[i].pfm_file != sa[i - 1].pfm_file)
+        {
+          before = i;
+          break;
+        }
+    }
+
+  if (after - break_point[2] < break_point[2] - before)
+    {
+      break_point[2] = after;
+    }
+  else
+    {
+      break_point[2] = before;
+    }
+
+  fprintf (stderr,"%s %s %d %d %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,before,after,read_count,misc->data[before].file,misc->data[after].file,break_point[2]);
+  */
+
+
+
+  //  The returns that need the return filter are collected in a batch for each channel and filtered HWF_BATCH_LANES at a
+  //  time (see return_filter_batch.cpp).  A return's verdict isn't known until its batch is run so anything that depends on
+  //  it is done in flush_batch.
+
+  RETURN_BATCH *batch = (RETURN_BATCH *) arena_alloc (&misc->arena, 2 * sizeof (RETURN_BATCH), NVTrue);
+  if (batch == NULL)
+    {
+      perror ("Allocating return filter batches in ingest_points.cpp");
+      return (NVFalse);
+    }
+
+  batch[HWF_APD].channel = HWF_APD;
+  batch[HWF_APD].size = HWF_APD_SIZE;
+  batch[HWF_APD].ac_off_req = misc->abe_share->filterShare.apd_ac_zero_offset_required;
+  batch[HWF_PMT].channel = HWF_PMT;
+  batch[HWF_PMT].size = HWF_PMT_SIZE;
+  batch[HWF_PMT].ac_off_req = misc->abe_share->filterShare.pmt_ac_zero_offset_required;
+  batch[HWF_APD].slope_req = batch[HWF_PMT].slope_req = slope_req;
+
+
+  //  Do the low slope filter on all the data points.
+
+  files.hof_fp = files.wave_fp = NULL;
+  int32_t prev_pfm_file = -999;
+
+
+  //  The primary and secondary returns of a shot have the same HOF and INH records (and they're next to each other in the
+  //  sorted list) so we only read them once.  The first drop (surface) of each channel's waveform only has to be found once
+  //  as well so we remember which lane of each batch has this shot's waveform.
+
+  int32_t shot_lane[2] = {-1, -1}, shot_file = -999, shot_rec = -1, shots = 0;
+  uint8_t have_hof = NVFalse, have_wave = NVFalse;
+
+  for (int32_t i = 0 ; i < read_count ; i++)
+    {
+      //  This is the wave_data index from the pfm/file/rec sorted array and the misc->data record number that goes with it.
+
+      int32_t k = sa[i].rec;
+      int32_t ndx = wave_data[k].ndx;
+
+
+      //  Only on PFM_HOF_CHARTS_DATA.
+
+      if (misc->data[ndx].type == PFM_CHARTS_HOF_DATA)
+        {
+          //  Since we sorted by PFM file combined with the file number, we only have to close and open a new file when the pfm_file number changes.
+
+          if (sa[i].pfm_file != prev_pfm_file)
+            {
+              //  If previous HOF and/or INH (wave) files were open, close them and open the new ones.
+
+              close_shot_files (&files);
+
+              if (!open_shot_files (misc, ndx, NVTrue, &files, progname))
+                {
+                  return (NVFalse);
+                }
+
+              pmt_ac_zero_offset = files.pmt_ac_zero_offset;
+              apd_ac_zero_offset = files.apd_ac_zero_offset;
+
+
+              //  Save the previous pfm_file number so we'll know when to open a new file.
+
+              prev_pfm_file = sa[i].pfm_file;
+            }
+
+
+          //  New shot.  If the --time_budget has run out we stop here (see filter_area), the points we've done are right.
+
+          if (sa[i].pfm_file != shot_file || sa[i].orig_rec != shot_rec)
+            {
+              if (!(++shots & 255) && out_of_time (misc))
+                {
+                  misc->partial = NVTrue;
+                  break;
+                }
+
+              have_hof = have_wave = NVFalse;
+              shot_lane[HWF_APD] = shot_lane[HWF_PMT] = -1;
+              shot_file = sa[i].pfm_file;
+              shot_rec = sa[i].orig_rec;
+            }
+
+
+          //  We want to store X and Y as meters from the lower left corner of the total MBR so that we can do our
+          //  distance calculations more quickly.
+
+          geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->abe_share->edit_area.min_y, misc->data[ndx].x, &wave_data[k].mx);
+          //invgp (NV_A0, NV_B0, misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->abe_share->edit_area.min_y, misc->data[ndx].x, &dist, &az);
+          //wave_data[k].mx = dist;
+          geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->data[ndx].y, misc->abe_share->edit_area.min_x, &wave_data[k].my);
+          //invgp (NV_A0, NV_B0, misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->data[ndx].y, misc->abe_share->edit_area.min_x, &dist, &az);
+          //wave_data[k].my = dist;
+
+
+          //  Set all of the check flags to NVTrue.  We'll unset them as we go along.
+
+          wave_data[k].check = NVTrue;
+
+
+          //  No point in checking already invalid data.
+
+          if (misc->data[ndx].val & PFM_INVAL)
+            {
+              wave_data[k].check = NVFalse;
+            }
+          else
+            {
+              //  Read the current HOF record (unless we just read it for the other return).
+
+              if (!have_hof)
+                {
+                  read_shot_record (misc, &files, ndx, &hof_record);
+                  misc->hof_reads++;
+                  have_hof = NVTrue;
+                }
+
+
+              //  No point in checking Shallow Water Algorithm, Shoreline Depth Swapped data, or land.  We still have to load the wave form data though.
+
+              if ((misc->data[ndx].sub == 0 && (hof_record.abdc == 72 || hof_record.abdc == 74 || hof_record.abdc == 70)) ||
+                  (misc->data[ndx].sub == 1 && (hof_record.sec_abdc == 72 || hof_record.sec_abdc == 74 || hof_record.sec_abdc == 70)))
+                wave_data[k].check = NVFalse;
+
+
+              apd_run_req = hof_record.calc_bot_run_required[0];
+              pmt_run_req = hof_record.calc_bot_run_required[1];
+
+
+              wave_data[k].bot_bin_first = hof_record.bot_bin_first;
+              wave_data[k].bot_bin_second = hof_record.bot_bin_second;
+
+              //  The return filters ignore Shallow Water Algorithm, Shoreline Depth Swapped, and land data so we only read the
+              //  waveform if the point is going to be checked.  We don't keep the waveform after the return filter has looked at
+              //  it.  The few waveforms that the waveform check needs are read after the proximity search (see load_waveforms.cpp).
+
+              if (wave_data[k].check)
+                {
+                  //  Read the corresponding wave data (same as above).
+
+                  if (!have_wave)
+                    {
+                      read_shot_waveform (misc, &files, ndx, &wave_rec, &apd, &pmt);
+                      misc->wave_reads++;
+                      have_wave = NVTrue;
+                    }
+
+
+                  //  Check to see if the sub_record we're looking for is PMT (0) or APD (1).
+
+                  int32_t channel = HWF_NO_CHANNEL;
+
+                  if ((misc->data[ndx].sub == 0 && hof_record.bot_channel == PMT) || (misc->data[ndx].sub == 1 && hof_record.sec_bot_chan == PMT))
+                    channel = HWF_PMT;
+
+                  if ((misc->data[ndx].sub == 0 && hof_record.bot_channel == APD) || (misc->data[ndx].sub == 1 && hof_record.sec_bot_chan == APD))
+                    channel = HWF_APD;
+
+
+                  //  Add the return to the channel's batch (running the batch first if it's full).  The waveform is copied
+                  //  since wave_rec is reused for the next shot.
+
+                  if (channel != HWF_NO_CHANNEL)
+                    {
+                      RETURN_BATCH *b = &batch[channel];
+
+                      if (b->count == HWF_BATCH_LANES)
+                        {
+                          flush_batch (misc, b, wave_data, state);
+                          shot_lane[channel] = -1;
+                        }
+
+                      RETURN_LANE *lane = &b->lane[b->count];
+
+                      lane->k = k;
+                      lane->ndx = ndx;
+                      lane->rec = misc->data[ndx].rec;
+                      lane->sub = misc->data[ndx].sub;
+                      lane->bin = (misc->data[ndx].sub == 0) ? hof_record.bot_bin_first : hof_record.bot_bin_second;
+                      lane->run_req = (channel == HWF_PMT) ? pmt_run_req : apd_run_req;
+                      lane->ac_zero_offset = (channel == HWF_PMT) ? pmt_ac_zero_offset : apd_ac_zero_offset;
+                      lane->same = shot_lane[channel];
+
+                      memcpy (b->wave[b->count], (channel == HWF_PMT) ? pmt : apd, b->size);
+
+                      shot_lane[channel] = b->count;
+                      b->count++;
+                    }
+                }
+            }
+
+
+          //  Points that were already invalid or killed (including by the return filter) aren't used as neighbors.
+
+          wave_data[k].killed = HWF_BIT_TEST (misc->kill_bits, ndx);
+
+
+          //  Save what we found in case the point is in the next band as well.
+
+          if (state)
+            {
+              state[ndx].flags = HWF_INGESTED;
+              if (wave_data[k].check) state[ndx].flags |= HWF_CHECK;
+              if (wave_data[k].killed) state[ndx].flags |= HWF_KILLED;
+              state[ndx].bot_bin_first = wave_data[k].bot_bin_first;
+              state[ndx].bot_bin_second = wave_data[k].bot_bin_second;
+            }
+
+
+          //  Get the next few records on their way (see shot_prefetch.cpp).
+
+          prefetch_shots (misc, &files, wave_data, sa, read_count, i);
+        }
+    }
+
+
+  flush_batch (misc, &batch[HWF_APD], wave_data, state);
+  flush_batch (misc, &batch[HWF_PMT], wave_data, state);
+
+  close_shot_files (&files);
+
+
+  return (NVTrue);
+}
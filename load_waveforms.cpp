@@ -0,0 +1,180 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        load_waveforms                                      *
+*                                                                           *
+*   Purpose:            Read the INH waveforms for a list of points into    *
+*                       the waveform pool (compressed if misc->compress is  *
+*                       set) and set wave_data[].wave to each point's slot. *
+*                       The list is sorted by PFM/file/record so that we    *
+*                       only open each INH file once and read it in order.  *
+*                       The primary and secondary returns of a shot have    *
+*                       the same waveform so when both are in the list it   *
+*                       is only read once and they share a slot.  The pool  *
+*                       is grown by the number of new slots so this can be  *
+*                       called again to add more waveforms (the pool        *
+*                       pointers must be NULL and misc->waveform_count      *
+*                       must be 0 before the first call).                   *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       wave_data      - the per point data                 *
+*                       list           - wave_data indices to load          *
+*                       count          - number of entries in list          *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t load_waveforms (MISC *misc, WAVE_DATA *wave_data, int32_t *list, int32_t count, char *progname)
+{
+  SHOT_FILES         files;
+  WAVE_DATA_T        wave_rec;
+  uint8_t            *apd, *pmt;
+
+
+  if (!count) return (NVTrue);
+
+
+  SORT_REC *sa = (SORT_REC *) arena_alloc (&misc->arena, 2 * count * sizeof (SORT_REC), NVFalse);
+  if (sa == NULL)
+    {
+      perror ("Allocating sort array in load_waveforms.cpp");
+      return (NVFalse);
+    }
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      int32_t ndx = wave_data[list[i]].ndx;
+
+      sa[i].pfm_file = misc->data[ndx].pfm * PFM_MAX_FILES + misc->data[ndx].file;
+      sa[i].orig_rec = misc->data[ndx].rec;
+      sa[i].rec = list[i];
+    }
+
+  sort_records (sa, count, sa + count);
+
+
+  //  One slot per shot.
+
+  int32_t shots = 0;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      if (!i || sa[i].pfm_file != sa[i - 1].pfm_file || sa[i].orig_rec != sa[i - 1].orig_rec) shots++;
+    }
+
+  int32_t first_slot = misc->waveform_count;
+
+  misc->waveform_count += shots;
+
+
+  if (misc->compress)
+    {
+      misc->packed = (PACKED_WAVEFORM *) realloc (misc->packed, misc->waveform_count * sizeof (PACKED_WAVEFORM));
+      if (misc->packed == NULL)
+        {
+          perror ("Allocating packed waveform pool in load_waveforms.cpp");
+          return (NVFalse);
+        }
+    }
+  else
+    {
+      misc->waveform = (WAVEFORM *) realloc (misc->waveform, misc->waveform_count * sizeof (WAVEFORM));
+      if (misc->waveform == NULL)
+        {
+          perror ("Allocating waveform pool in load_waveforms.cpp");
+          return (NVFalse);
+        }
+    }
+
+
+  files.hof_fp = files.wave_fp = NULL;
+  int32_t prev_pfm_file = -999, slot = first_slot - 1;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      int32_t k = sa[i].rec;
+      int32_t ndx = wave_data[k].ndx;
+
+
+      //  The other return of the shot we just read.
+
+      if (i && sa[i].pfm_file == sa[i - 1].pfm_file && sa[i].orig_rec == sa[i - 1].orig_rec)
+        {
+          wave_data[k].wave = slot;
+          continue;
+        }
+
+      slot++;
+      wave_data[k].wave = slot;
+
+
+      //  Only open a new INH file when the pfm_file number changes.
+
+      if (sa[i].pfm_file != prev_pfm_file)
+        {
+          close_shot_files (&files);
+
+          if (!open_shot_files (misc, ndx, NVFalse, &files, progname))
+            {
+              return (NVFalse);
+            }
+
+          prev_pfm_file = sa[i].pfm_file;
+        }
+
+
+      //  The waveforms are packed (or copied into the pool) straight out of the INH record.  This is the only copy.
+
+      read_shot_waveform (misc, &files, ndx, &wave_rec, &apd, &pmt);
+      misc->wave_reads++;
+
+      if (misc->compress)
+        {
+          if (!pack_waveform (misc, slot, apd, pmt))
+            {
+              close_shot_files (&files);
+              return (NVFalse);
+            }
+        }
+      else
+        {
+          memcpy (misc->waveform[slot].apd, apd, HWF_APD_SIZE);
+          memcpy (misc->waveform[slot].pmt, pmt, HWF_PMT_SIZE);
+        }
+
+      prefetch_shots (misc, &files, wave_data, sa, count, i);
+    }
+
+
+  close_shot_files (&files);
+
+
+  return (NVTrue);
+}
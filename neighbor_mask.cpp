@@ -0,0 +1,136 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#define HWF_X86
+#endif
+
+
+/*  Scalar version of neighbor_mask (also used for the leftovers at the end of a batch).  */
+
+static uint32_t neighbor_mask_scalar (BIN_GRID *grid, int32_t start, int32_t count, float cx, float cy, float base)
+{
+  uint32_t mask = 0;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      float dx = grid->lx[start + i] - cx;
+      float dy = grid->ly[start + i] - cy;
+      float limit = (base + grid->herr[start + i]) * HWF_MASK_SCALE + grid->slack;
+
+      if (dx * dx + dy * dy <= limit * limit) mask |= (1U << i);
+    }
+
+  return (mask);
+}
+
+
+#ifdef HWF_X86
+
+/*  AVX2 version of neighbor_mask.  Eight neighbors at a time.  */
+
+__attribute__ ((target ("avx2")))
+static uint32_t neighbor_mask_avx2 (BIN_GRID *grid, int32_t start, int32_t count, float cx, float cy, float base)
+{
+  uint32_t mask = 0;
+  int32_t i = 0;
+
+  __m256 vcx = _mm256_set1_ps (cx);
+  __m256 vcy = _mm256_set1_ps (cy);
+  __m256 vbase = _mm256_set1_ps (base);
+  __m256 vscale = _mm256_set1_ps (HWF_MASK_SCALE);
+  __m256 vslack = _mm256_set1_ps (grid->slack);
+
+  for ( ; i + 8 <= count ; i += 8)
+    {
+      __m256 dx = _mm256_sub_ps (_mm256_loadu_ps (&grid->lx[start + i]), vcx);
+      __m256 dy = _mm256_sub_ps (_mm256_loadu_ps (&grid->ly[start + i]), vcy);
+      __m256 limit = _mm256_add_ps (_mm256_mul_ps (_mm256_add_ps (vbase, _mm256_loadu_ps (&grid->herr[start + i])), vscale), vslack);
+
+      __m256 d2 = _mm256_add_ps (_mm256_mul_ps (dx, dx), _mm256_mul_ps (dy, dy));
+      __m256 in = _mm256_cmp_ps (d2, _mm256_mul_ps (limit, limit), _CMP_LE_OQ);
+
+      mask |= ((uint32_t) _mm256_movemask_ps (in)) << i;
+    }
+
+
+  //  The compiler doesn't always clear the upper halves of the AVX registers on the way out of here (in particular when we
+  //  call the scalar version for the leftovers).  If they're left dirty every SSE instruction after this (all of libm) runs
+  //  much slower on a lot of CPUs.
+
+  _mm256_zeroupper ();
+
+  if (i < count) mask |= neighbor_mask_scalar (grid, start + i, count - i, cx, cy, base) << i;
+
+  return (mask);
+}
+
+#endif
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        neighbor_mask                                       *
+*                                                                           *
+*   Purpose:            Quick single precision distance test for a batch    *
+*                       of up to 32 consecutive points in the bin grid      *
+*                       (normally part of one line group in one bin).       *
+*                       The limit is padded (HWF_MASK_SCALE and             *
+*                       grid->slack) so that any point that passes the      *
+*                       full double precision test is always in the mask.   *
+*                       The mask is only used to skip points, every point   *
+*                       in it still gets the double precision test.         *
+*                                                                           *
+*   Arguments:          grid           - the bin grid                       *
+*                       start          - index of the first point           *
+*                       count          - number of points (<= 32)           *
+*                       cx             - candidate X in the frame of the    *
+*                                        neighbor bin (see BIN_GRID.lx)     *
+*                       cy             - candidate Y in the frame of the    *
+*                                        neighbor bin                       *
+*                       base           - search radius plus the candidate's *
+*                                        horizontal error                   *
+*                                                                           *
+*   Return Value:       uint32_t       - bit i set if point start + i may   *
+*                                        be within the search distance      *
+*                                                                           *
+\***************************************************************************/
+
+uint32_t neighbor_mask (BIN_GRID *grid, int32_t start, int32_t count, float cx, float cy, float base)
+{
+#ifdef HWF_X86
+
+  //  Initialized the first time through (thread safe, the proximity passes call this from the worker threads).
+
+  static const int32_t have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+
+  if (have_avx2) return (neighbor_mask_avx2 (grid, start, count, cx, cy, base));
+
+#endif
+
+  return (neighbor_mask_scalar (grid, start, count, cx, cy, base));
+}
@@ -51,6 +51,12 @@
 *                       ac_off_req     - points selected less than this     *
 *                                        value above the AC zero offset     *
 *                                        will be marked invalid             *
+*                       pmt            - the PMT waveform                   *
+*                       surface        - the first drop (surface) bin for   *
+*                                        this waveform, or -1 to have it    *
+*                                        found (it's set when it is)        *
+*                       trace          - if not NULL, gets the rule that    *
+*                                        killed the return and its numbers  *
 *                                                                           *
 *   Return Value:       uint8_t        - NVTrue if we need to kill the      *
 *                                        return                             *
@@ -58,7 +64,8 @@
 \***************************************************************************/
 
 uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec, HYDRO_OUTPUT_T *hof_record, int32_t pmt_run_req,
-                           float slope_req, int32_t ac_zero_offset, int32_t ac_off_req, WAVE_DATA_T *wave_rec)
+                           float slope_req, int32_t ac_zero_offset, int32_t ac_off_req, uint8_t *pmt,
+                           int32_t *surface, TRACE_REC *trace)
 {
   //  Make sure the return we're looking for is not shallow water algorithm, shoreline depth swapped, or land.
 
@@ -81,7 +88,18 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
 
   //  Check the AC zero offset (don't do the check if the required offset is set to 0).
 
-  if (ac_off_req && (wave_rec->pmt[bin] - ac_zero_offset < ac_off_req)) return (NVTrue);
+  if (ac_off_req && (pmt[bin] - ac_zero_offset < ac_off_req))
+    {
+      if (trace)
+        {
+          trace->rule = HWF_RULE_AC_OFFSET;
+          trace->bin = bin;
+          trace->run = pmt[bin] - ac_zero_offset;
+          trace->slope = 0.0;
+        }
+
+      return (NVTrue);
+    }
 
 
   //  Initialize the run and slope variables for the PMT data.
@@ -97,48 +115,29 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
   float backslope = 0.0;
 
 
-  //  Initialize the first_drop index.  We don't want to start searching for runs until we've cleared the surface
-  //  return.  This is not how Optech does it but I'm not really interested in very shallow water for this filter.
+  //  Get the first_drop index (unless we already have it for this shot's waveform).  We don't want to start searching for
+  //  runs until we've cleared the surface return.  This is not how Optech does it but I'm not really interested in very
+  //  shallow water for this filter.
 
-  int32_t first_drop = 0;
+  if (*surface < 0) *surface = find_first_drop (pmt, HWF_PMT_SIZE);
 
+  int32_t first_drop = *surface;
 
-  //  Loop through the PMT data looking for the first drop (from the surface).  Skip the first 20
-  //  bins so that we don't start looking in the noisy section prior to the surface return.
-
-  for (int32_t i = 20 ; i < HWF_PMT_SIZE ; i++)
-    {
-      //  If we get three zeros in a row we want to reset the drop counter.
-
-      int32_t change = (wave_rec->pmt[i] - wave_rec->pmt[i - 1]) + (wave_rec->pmt[i - 1] - wave_rec->pmt[i - 2]) +
-        (wave_rec->pmt[i - 2] - wave_rec->pmt[i - 3]);
-
-      if (!change) drop = 0;
-
-
-      if (wave_rec->pmt[i] - wave_rec->pmt[i - 1] <= 0)
-        {
-          //  Increment the drop counter.
-
-          drop++;
 
+  //  If the return bin is prior to the first drop (ie surface return) we want to go ahead and kill it.
 
-          if (drop >= 5)
-            {
-              first_drop = i;
-              break;
-            }
-        }
-      else
+  if (bin < first_drop)
+    {
+      if (trace)
         {
-          drop = 0;
+          trace->rule = HWF_RULE_SURFACE;
+          trace->bin = bin;
+          trace->run = first_drop;
+          trace->slope = 0.0;
         }
-    }
-              
-
-  //  If the return bin is prior to the first drop (ie surface return) we want to go ahead and kill it.
 
-  if (bin < first_drop) return (NVTrue);
+      return (NVTrue);
+    }
 
 
   rise = 0;
@@ -149,7 +148,7 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
 
   for (int32_t i = bin ; i >= 20 ; i--)
     {
-      if (wave_rec->pmt[i] - wave_rec->pmt[i - 1] <= 0)
+      if (pmt[i] - pmt[i - 1] <= 0)
         {
           if (!start_data) start_data = i;
 
@@ -175,7 +174,7 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
 
   for (int32_t i = bin ; i < length ; i++)
     {
-      if (wave_rec->pmt[i] - wave_rec->pmt[i - 1] < 0)
+      if (pmt[i] - pmt[i - 1] < 0)
         {
           if (!peak) peak = i;
 
@@ -194,7 +193,7 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
   //  Compute the slope.
 
   run = peak - start_data;
-  slope = (float) (wave_rec->pmt[peak] - wave_rec->pmt[start_data]) / (float) run;
+  slope = (float) (pmt[peak] - pmt[start_data]) / (float) run;
 
 
   length = qMin (peak + 50, HWF_PMT_SIZE - 1);
@@ -204,7 +203,7 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
 
   for (int32_t i = peak ; i < length ; i++)
     {
-      if (wave_rec->pmt[i] - wave_rec->pmt[i - 1] > 1)
+      if (pmt[i] - pmt[i - 1] > 1)
         {
           end_data = i;
           break;
@@ -223,7 +222,7 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
     }
   else
     {
-      backslope = (float) (wave_rec->pmt[peak] - wave_rec->pmt[end_data]) / (float) back_run;
+      backslope = (float) (pmt[peak] - pmt[end_data]) / (float) back_run;
     }
 
 
@@ -241,6 +240,15 @@ uint8_t pmt_return_filter (int32_t rec __attribute__ ((unused)), int32_t sub_rec
     {
       //fprintf(stderr,"%s %s %d %d %d %d %d\n",__FILE__,__FUNCTION__,__LINE__,bin,start_data, peak, end_data);
       //fprintf(stderr,"%s %s %d %d %d %f %f %f\n",__FILE__,__FUNCTION__,__LINE__,run,pmt_run_req,slope, backslope,slope_req);
+
+      if (trace)
+        {
+          trace->rule = (run < pmt_run_req) ? HWF_RULE_RUN : HWF_RULE_SLOPE;
+          trace->bin = bin;
+          trace->run = run;
+          trace->slope = slope;
+        }
+
       return (NVTrue);
     }
 
@@ -0,0 +1,603 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "hofWaveFilter.hpp"
+
+
+//  This is the filter the way it was before any of the speedups (one big bin array, every waveform in memory, and the
+//  neighbors gathered for each point as it's checked).  It's slow and it uses a lot of memory but it's easy to follow so
+//  it's what --verify compares the real thing against.  DON'T optimize anything in here.  The only changes from the
+//  original are that the return filters say which rule fired, non-HOF points aren't binned (they never had positions),
+//  the bin array is sized from the points instead of the edit area, and the files are read through shot_io.cpp so that
+//  synthetic point clouds work.
+
+typedef struct
+{
+  double      mx;                        //  X position in meters
+  double      my;                        //  Y position in meters
+  uint8_t     check;                     //  Set if we need to check adjacent waveforms (e.g. this is an isolated point)
+  int32_t     bot_bin_first;
+  int32_t     bot_bin_second;
+  uint8_t     apd[HWF_APD_SIZE];
+  uint8_t     pmt[HWF_PMT_SIZE];
+} REF_DATA;
+
+
+typedef struct
+{
+  int32_t     count;
+  int32_t     *data;
+} REF_BIN;
+
+
+
+/*  The APD and PMT return filters were identical except for the waveform they looked at so there's only one copy here.
+    Returns the HWF_RULE that killed the return or 0.  */
+
+static uint8_t ref_return_filter (int32_t sub_rec, HYDRO_OUTPUT_T *hof_record, uint8_t *wave, int32_t size, int32_t run_req, float slope_req,
+                                  int32_t ac_zero_offset, int32_t ac_off_req)
+{
+  //  Make sure the return we're looking for is not shallow water algorithm, shoreline depth swapped, or land.
+
+  if ((sub_rec == 0 && (hof_record->abdc == 72 || hof_record->abdc == 74 || hof_record->abdc == 70)) ||
+      (sub_rec == 1 && (hof_record->sec_abdc == 72 || hof_record->sec_abdc == 74 || hof_record->sec_abdc == 70))) return (0);
+
+
+  int32_t bin = hof_record->bot_bin_first;
+  if (sub_rec == 1) bin = hof_record->bot_bin_second;
+
+
+  //  Check the AC zero offset (don't do the check if the required offset is set to 0).
+
+  if (ac_off_req && (wave[bin] - ac_zero_offset < ac_off_req)) return (HWF_RULE_AC_OFFSET);
+
+
+  int32_t rise = 0;
+  int32_t drop = 0;
+  int32_t start_data = 0;
+  int32_t end_data = 0;
+  int32_t peak = 0;
+  int32_t run = 0;
+  int32_t back_run = 0;
+  float slope = 0.0;
+  float backslope = 0.0;
+
+
+  //  Look for the first drop (from the surface) skipping the first 20 bins.
+
+  int32_t first_drop = 0;
+
+  for (int32_t i = 20 ; i < size ; i++)
+    {
+      int32_t change = (wave[i] - wave[i - 1]) + (wave[i - 1] - wave[i - 2]) + (wave[i - 2] - wave[i - 3]);
+
+      if (!change) drop = 0;
+
+      if (wave[i] - wave[i - 1] <= 0)
+        {
+          drop++;
+
+          if (drop >= 5)
+            {
+              first_drop = i;
+              break;
+            }
+        }
+      else
+        {
+          drop = 0;
+        }
+    }
+
+
+  //  If the return bin is prior to the first drop (ie surface return) we want to go ahead and kill it.
+
+  if (bin < first_drop) return (HWF_RULE_SURFACE);
+
+
+  rise = 0;
+  start_data = 0;
+
+
+  //  Find the start of the run.
+
+  for (int32_t i = bin ; i >= 20 ; i--)
+    {
+      if (wave[i] - wave[i - 1] <= 0)
+        {
+          if (!start_data) start_data = i;
+
+          rise++;
+
+          if (rise >= 2) break;
+        }
+      else
+        {
+          rise = 0;
+          start_data = 0;
+        }
+    }
+
+
+  drop = 0;
+  peak = 0;
+
+
+  //  Find the peak.
+
+  int32_t length = qMin (bin + 50, size - 1);
+
+  for (int32_t i = bin ; i < length ; i++)
+    {
+      if (wave[i] - wave[i - 1] < 0)
+        {
+          if (!peak) peak = i;
+
+          drop++;
+
+          if (drop >= 2) break;
+        }
+      else
+        {
+          drop = 0;
+          peak = 0;
+        }
+    }
+
+
+  //  Compute the slope.
+
+  run = peak - start_data;
+  slope = (float) (wave[peak] - wave[start_data]) / (float) run;
+
+
+  length = qMin (peak + 50, size - 1);
+
+
+  //  Find the end of the backslope.
+
+  for (int32_t i = peak ; i < length ; i++)
+    {
+      if (wave[i] - wave[i - 1] > 1)
+        {
+          end_data = i;
+          break;
+        }
+    }
+
+
+  back_run = end_data - peak;
+
+  if (back_run < run)
+    {
+      backslope = 999.0;
+    }
+  else
+    {
+      backslope = (float) (wave[peak] - wave[end_data]) / (float) back_run;
+    }
+
+
+  //  The backslope isn't used any more.
+
+  backslope = slope_req;
+
+
+  if (run < run_req || slope < slope_req || backslope < slope_req) return (run < run_req ? HWF_RULE_RUN : HWF_RULE_SLOPE);
+
+
+  return (0);
+}
+
+
+
+/*  The waveform check.  points/point_count are the neighbors within the search radius.  */
+
+static uint8_t ref_waveform_check (MISC *misc, REF_DATA *ref_data, int32_t recnum, int32_t *points, int32_t point_count)
+{
+  int32_t bin = ref_data[recnum].bot_bin_first;
+
+  if (misc->data[recnum].sub) bin = ref_data[recnum].bot_bin_second;
+
+
+  //  I'm not looking at surface data.
+
+  if (bin < 20) return (NVFalse);
+
+
+  for (int32_t i = 0 ; i < point_count ; i++)
+    {
+      int32_t start_apd_search = qMax (20, bin - misc->abe_share->filterShare.search_width);
+      int32_t start_pmt_search = qMax (20, bin - misc->abe_share->filterShare.search_width);
+      int32_t end_apd_search = qMin (HWF_APD_SIZE - 1, bin + misc->abe_share->filterShare.search_width);
+      int32_t end_pmt_search = qMin (HWF_PMT_SIZE - 1, bin + misc->abe_share->filterShare.search_width);
+      int32_t rise_count = 0;
+      int32_t ndx = points[i];
+
+      if (start_apd_search < HWF_APD_SIZE - 20)
+        {
+          for (int32_t j = start_apd_search ; j < end_apd_search ; j++)
+            {
+              if (ref_data[ndx].apd[j] - ref_data[ndx].apd[j - 1] > 0)
+                {
+                  rise_count++;
+                }
+              else if (ref_data[ndx].apd[j] - ref_data[ndx].apd[j - 1] < 0)
+                {
+                  rise_count = 0;
+                }
+
+              if (rise_count >= misc->abe_share->filterShare.rise_threshold) return (NVFalse);
+            }
+        }
+
+
+      rise_count = 0;
+
+      for (int32_t j = start_pmt_search ; j < end_pmt_search ; j++)
+        {
+          if (ref_data[ndx].pmt[j] - ref_data[ndx].pmt[j - 1] > 0)
+            {
+              rise_count++;
+            }
+          else if (ref_data[ndx].pmt[j] - ref_data[ndx].pmt[j - 1] < 0)
+            {
+              rise_count = 0;
+            }
+
+          if (rise_count >= misc->abe_share->filterShare.rise_threshold) return (NVFalse);
+        }
+    }
+
+
+  return (NVTrue);
+}
+
+
+
+/*  Is point indx a neighbor of point ndx (valid, not killed, different line, and within the search radius)?  */
+
+static uint8_t ref_neighbor (MISC *misc, REF_DATA *ref_data, int32_t ndx, int32_t indx)
+{
+  if ((misc->data[indx].val & PFM_INVAL) || misc->data[indx].exflag) return (NVFalse);
+
+  if (misc->data[ndx].line == misc->data[indx].line) return (NVFalse);
+
+  double diff_x = fabs (ref_data[ndx].mx - ref_data[indx].mx);
+  double diff_y = fabs (ref_data[ndx].my - ref_data[indx].my);
+
+  double dist = misc->abe_share->filterShare.search_radius + misc->data[ndx].herr + misc->data[indx].herr;
+
+  if (diff_x > dist || diff_y > dist) return (NVFalse);
+
+  return (sqrt (diff_x * diff_x + diff_y * diff_y) <= dist);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        reference_filter                                    *
+*                                                                           *
+*   Purpose:            Run the reference version of the whole filter on    *
+*                       the point cloud, setting exflag for the points that *
+*                       should be killed.                                   *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       rule           - the last HWF_RULE that the         *
+*                                        reference applied to each point    *
+*                                        (0 if none, indexed by misc->data  *
+*                                        index)                             *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t reference_filter (MISC *misc, uint8_t *rule, char *progname)
+{
+  SHOT_FILES         files;
+  HYDRO_OUTPUT_T     hof_record;
+  WAVE_DATA_T        wave_rec;
+  uint8_t            *apd, *pmt;
+  float              slope_req = misc->slope_req;
+  int32_t            count = misc->abe_share->point_cloud_count;
+
+
+  REF_DATA *ref_data = (REF_DATA *) calloc (qMax (count, 1), sizeof (REF_DATA));
+  SORT_REC *sa = (SORT_REC *) malloc (2 * qMax (count, 1) * sizeof (SORT_REC));
+  if (ref_data == NULL || sa == NULL)
+    {
+      perror ("Allocating reference memory in reference_filter.cpp");
+      if (ref_data) free (ref_data);
+      if (sa) free (sa);
+      return (NVFalse);
+    }
+
+  memset (rule, 0, qMax (count, 1));
+
+
+  //  Read everything and do the return filters.
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      sa[i].pfm_file = misc->data[i].pfm * PFM_MAX_FILES + misc->data[i].file;
+      sa[i].orig_rec = misc->data[i].rec;
+      sa[i].rec = i;
+    }
+
+  sort_records (sa, count, sa + qMax (count, 1));
+
+  files.hof_fp = files.wave_fp = NULL;
+  int32_t prev_pfm_file = -999;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      int32_t ndx = sa[i].rec;
+
+      if (misc->data[ndx].type != PFM_CHARTS_HOF_DATA) continue;
+
+      if (sa[i].pfm_file != prev_pfm_file)
+        {
+          close_shot_files (&files);
+
+          if (!open_shot_files (misc, ndx, NVTrue, &files, progname))
+            {
+              free (ref_data);
+              free (sa);
+              return (NVFalse);
+            }
+
+          prev_pfm_file = sa[i].pfm_file;
+        }
+
+      geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->abe_share->edit_area.min_y, misc->data[ndx].x, &ref_data[ndx].mx);
+      geo_distance (misc->abe_share->edit_area.min_y, misc->abe_share->edit_area.min_x, misc->data[ndx].y, misc->abe_share->edit_area.min_x, &ref_data[ndx].my);
+
+      ref_data[ndx].check = NVTrue;
+
+      if (misc->data[ndx].val & PFM_INVAL)
+        {
+          ref_data[ndx].check = NVFalse;
+          continue;
+        }
+
+      read_shot_record (misc, &files, ndx, &hof_record);
+
+      if ((misc->data[ndx].sub == 0 && (hof_record.abdc == 72 || hof_record.abdc == 74 || hof_record.abdc == 70)) ||
+          (misc->data[ndx].sub == 1 && (hof_record.sec_abdc == 72 || hof_record.sec_abdc == 74 || hof_record.sec_abdc == 70)))
+        ref_data[ndx].check = NVFalse;
+
+      ref_data[ndx].bot_bin_first = hof_record.bot_bin_first;
+      ref_data[ndx].bot_bin_second = hof_record.bot_bin_second;
+
+      read_shot_waveform (misc, &files, ndx, &wave_rec, &apd, &pmt);
+
+      memcpy (ref_data[ndx].apd, apd, HWF_APD_SIZE);
+      memcpy (ref_data[ndx].pmt, pmt, HWF_PMT_SIZE);
+
+      uint8_t killed = 0;
+
+      if ((misc->data[ndx].sub == 0 && hof_record.bot_channel == PMT) || (misc->data[ndx].sub == 1 && hof_record.sec_bot_chan == PMT))
+        {
+          killed = ref_return_filter (misc->data[ndx].sub, &hof_record, pmt, HWF_PMT_SIZE, hof_record.calc_bot_run_required[1], slope_req,
+                                      files.pmt_ac_zero_offset, misc->abe_share->filterShare.pmt_ac_zero_offset_required);
+          if (killed)
+            {
+              misc->data[ndx].exflag = NVTrue;
+              rule[ndx] = killed;
+            }
+        }
+
+      if ((misc->data[ndx].sub == 0 && hof_record.bot_channel == APD) || (misc->data[ndx].sub == 1 && hof_record.sec_bot_chan == APD))
+        {
+          killed = ref_return_filter (misc->data[ndx].sub, &hof_record, apd, HWF_APD_SIZE, hof_record.calc_bot_run_required[0], slope_req,
+                                      files.apd_ac_zero_offset, misc->abe_share->filterShare.apd_ac_zero_offset_required);
+          if (killed)
+            {
+              misc->data[ndx].exflag = NVTrue;
+              rule[ndx] = killed;
+            }
+        }
+    }
+
+  close_shot_files (&files);
+
+  free (sa);
+
+
+  //  Bin the HOF points (twice the search radius) in point order.
+
+  double search_bin_size_meters = misc->abe_share->filterShare.search_radius * 2.0;
+  int32_t rows = 1, cols = 1;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      if (misc->data[i].type != PFM_CHARTS_HOF_DATA) continue;
+
+      rows = qMax (rows, (int32_t) (ref_data[i].my / search_bin_size_meters) + 1);
+      cols = qMax (cols, (int32_t) (ref_data[i].mx / search_bin_size_meters) + 1);
+    }
+
+  REF_BIN *bin_data = (REF_BIN *) calloc ((int64_t) rows * cols, sizeof (REF_BIN));
+  if (bin_data == NULL)
+    {
+      perror ("Allocating reference bins in reference_filter.cpp");
+      free (ref_data);
+      return (NVFalse);
+    }
+
+  //  If we run out of memory we still fall through to the end to free everything.
+
+  uint8_t status = NVTrue;
+
+  for (int32_t i = 0 ; i < count && status ; i++)
+    {
+      if (misc->data[i].type != PFM_CHARTS_HOF_DATA) continue;
+
+      REF_BIN *bin = &bin_data[(int64_t) ((int32_t) (ref_data[i].my / search_bin_size_meters)) * cols + (int32_t) (ref_data[i].mx / search_bin_size_meters)];
+
+      int32_t *data = (int32_t *) realloc (bin->data, (bin->count + 1) * sizeof (int32_t));
+      if (data == NULL)
+        {
+          perror ("Allocating reference bin data in reference_filter.cpp");
+          status = NVFalse;
+          break;
+        }
+
+      bin->data = data;
+      bin->data[bin->count] = i;
+      bin->count++;
+    }
+
+
+  //  Hockey Puck of Confidence (TM).  A point with a depth consistent neighbor from another line doesn't need to be checked and
+  //  neither does the neighbor (the first one in each bin).
+
+  for (int32_t i = 0 ; i < rows && status ; i++)
+    {
+      for (int32_t j = 0 ; j < cols ; j++)
+        {
+          REF_BIN *bin = &bin_data[(int64_t) i * cols + j];
+
+          for (int32_t k = 0 ; k < bin->count ; k++)
+            {
+              int32_t ndx = bin->data[k];
+
+              if (!ref_data[ndx].check) continue;
+
+              uint8_t only_one_line = NVTrue;
+
+              for (int32_t m = qMax (0, i - 1) ; m <= qMin (rows - 1, i + 1) ; m++)
+                {
+                  for (int32_t n = qMax (0, j - 1) ; n <= qMin (cols - 1, j + 1) ; n++)
+                    {
+                      REF_BIN *nbin = &bin_data[(int64_t) m * cols + n];
+
+                      for (int32_t p = 0 ; p < nbin->count ; p++)
+                        {
+                          int32_t indx = nbin->data[p];
+
+                          if (indx != ndx && ref_neighbor (misc, ref_data, ndx, indx))
+                            {
+                              only_one_line = NVFalse;
+
+                              if (fabs (misc->data[ndx].z - misc->data[indx].z) < ((misc->data[ndx].verr + misc->data[indx].verr) / 2.0))
+                                {
+                                  ref_data[ndx].check = ref_data[indx].check = NVFalse;
+                                  break;
+                                }
+                            }
+                        }
+                    }
+                }
+
+              if (only_one_line)
+                {
+                  ref_data[ndx].check = NVFalse;
+                  if (!misc->data[ndx].exflag) rule[ndx] = HWF_RULE_ONE_LINE;
+                }
+            }
+        }
+    }
+
+
+  //  Waveform check on the points that still need it, in row/column/point order.
+
+  int32_t *points = NULL, point_count = 0, point_size = 0;
+
+  for (int32_t i = 0 ; i < rows && status ; i++)
+    {
+      for (int32_t j = 0 ; j < cols && status ; j++)
+        {
+          REF_BIN *bin = &bin_data[(int64_t) i * cols + j];
+
+          for (int32_t k = 0 ; k < bin->count && status ; k++)
+            {
+              int32_t ndx = bin->data[k];
+
+              if (!ref_data[ndx].check || misc->data[ndx].exflag) continue;
+
+              point_count = 0;
+
+              for (int32_t m = qMax (0, i - 1) ; m <= qMin (rows - 1, i + 1) && status ; m++)
+                {
+                  for (int32_t n = qMax (0, j - 1) ; n <= qMin (cols - 1, j + 1) && status ; n++)
+                    {
+                      REF_BIN *nbin = &bin_data[(int64_t) m * cols + n];
+
+                      for (int32_t p = 0 ; p < nbin->count ; p++)
+                        {
+                          int32_t indx = nbin->data[p];
+
+                          if (indx != ndx && ref_neighbor (misc, ref_data, ndx, indx))
+                            {
+                              if (point_count == point_size)
+                                {
+                                  point_size = qMax (64, point_size * 2);
+
+                                  int32_t *new_points = (int32_t *) realloc (points, point_size * sizeof (int32_t));
+                                  if (new_points == NULL)
+                                    {
+                                      perror ("Allocating reference points in reference_filter.cpp");
+                                      status = NVFalse;
+                                      break;
+                                    }
+
+                                  points = new_points;
+                                }
+
+                              points[point_count] = indx;
+                              point_count++;
+                            }
+                        }
+                    }
+                }
+
+              if (!status) break;
+
+              if (ref_waveform_check (misc, ref_data, ndx, points, point_count))
+                {
+                  misc->data[ndx].exflag = NVTrue;
+                  rule[ndx] = HWF_RULE_NO_RISE;
+                }
+              else
+                {
+                  rule[ndx] = HWF_RULE_RISE;
+                }
+            }
+        }
+    }
+
+
+  if (points) free (points);
+
+  for (int64_t i = 0 ; i < (int64_t) rows * cols ; i++) if (bin_data[i].data) free (bin_data[i].data);
+  free (bin_data);
+
+  free (ref_data);
+
+
+  return (status);
+}
@@ -0,0 +1,409 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#define HWF_X86
+#endif
+
+
+//  The return filters (apd_return_filter.cpp and pmt_return_filter.cpp) look at one waveform at a time and nearly all of
+//  their time goes into three short scans that stop wherever the data says to: the first drop (surface), the start of the
+//  run before the bottom bin, and the peak after it.  Here each scan steps all of the lanes of a batch at once (one return
+//  per lane, one byte per lane) and keeps a mask of the lanes that have stopped.  The scans only need byte compares
+//  (wave[i] - wave[i - 1] <= 0 is wave[i] <= wave[i - 1], and the three bin change in the first drop test adds up to
+//  wave[i] - wave[i - 3]) so all 32 lanes fit in one AVX2 register.
+//
+//  The run start scan only looks HWF_BATCH_BACK bins back from the bottom bin.  The few lanes that get that far without
+//  finding the start (and any lane with a bottom bin outside of the waveform) are finished by the scalar return filter so
+//  every verdict is exactly what the scalar filter gives.  Without AVX2 every lane is done by the scalar filter.
+
+
+/*  Run one lane through the scalar return filter.  The lane's surface is used if we already have it.  */
+
+static void finish_lane (RETURN_BATCH *batch, int32_t l)
+{
+  RETURN_LANE *lane = &batch->lane[l];
+
+
+  //  The batch is only given returns that are going to be checked so the HOF record's only job is to hold the bottom bin
+  //  (the ABDC codes that the filter skips are left at zero).
+
+  batch->hof.bot_bin_first = batch->hof.bot_bin_second = lane->bin;
+
+  if (batch->channel == HWF_PMT)
+    {
+      lane->killed = pmt_return_filter (lane->rec, lane->sub, &batch->hof, lane->run_req, batch->slope_req, lane->ac_zero_offset,
+                                        batch->ac_off_req, batch->wave[l], &lane->surface, &lane->trace);
+    }
+  else
+    {
+      lane->killed = apd_return_filter (lane->rec, lane->sub, &batch->hof, lane->run_req, batch->slope_req, lane->ac_zero_offset,
+                                        batch->ac_off_req, batch->wave[l], &lane->surface, &lane->trace);
+    }
+}
+
+
+#ifdef HWF_X86
+
+/*  Copy bins first through last - 1 of the lanes in mask into the rows.  */
+
+static void fill_rows (RETURN_BATCH *batch, uint32_t mask, int32_t first, int32_t last)
+{
+  for (int32_t l = 0 ; l < batch->count ; l++)
+    {
+      if (!(mask & (1U << l))) continue;
+
+      for (int32_t i = first ; i < last ; i++) batch->row[i][l] = batch->wave[l][i];
+    }
+}
+
+
+
+/*  First drop scan (see find_first_drop.cpp) of the lanes in todo.  The rows are filled a block at a time as the scan gets to
+    them since most surfaces are found in the first few dozen bins.  */
+
+__attribute__ ((target ("avx2")))
+static void surface_scan_avx2 (RETURN_BATCH *batch, uint32_t todo)
+{
+  const __m256i one = _mm256_set1_epi8 (1);
+  const __m256i five = _mm256_set1_epi8 (5);
+  __m256i drop = _mm256_setzero_si256 ();
+  uint32_t found = ~todo;
+  int32_t filled = 0;
+
+  for (int32_t i = 20 ; i < batch->size && found != 0xffffffff ; i++)
+    {
+      if (i >= filled)
+        {
+          int32_t last = qMin (i + HWF_BATCH_LANES, batch->size);
+          fill_rows (batch, ~found, filled, last);
+          filled = last;
+        }
+
+      __m256i cur = _mm256_loadu_si256 ((__m256i *) batch->row[i]);
+      __m256i prev = _mm256_loadu_si256 ((__m256i *) batch->row[i - 1]);
+      __m256i back = _mm256_loadu_si256 ((__m256i *) batch->row[i - 3]);
+
+
+      //  No change over three bins resets the drop counter, then a drop (or flat) adds one and a rise resets it.  Lanes that
+      //  have already been found keep counting (and wrapping) but they're ignored.
+
+      drop = _mm256_andnot_si256 (_mm256_cmpeq_epi8 (cur, back), drop);
+
+      __m256i down = _mm256_cmpeq_epi8 (_mm256_min_epu8 (cur, prev), cur);
+
+      drop = _mm256_and_si256 (down, _mm256_add_epi8 (drop, one));
+
+      uint32_t hit = (uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (drop, five)) & ~found;
+
+      if (hit)
+        {
+          for (int32_t l = 0 ; l < HWF_BATCH_LANES ; l++) if (hit & (1U << l)) batch->lane[l].surface = i;
+          found |= hit;
+        }
+    }
+
+  _mm256_zeroupper ();
+
+  for (int32_t l = 0 ; l < batch->count ; l++) if (!(found & (1U << l))) batch->lane[l].surface = 0;
+}
+
+
+
+/*  Run start scan.  Window row j is bin (bottom bin + j - HWF_BATCH_BACK) of each lane and a lane stops at row lo[l] (bin
+    20).  start[l] gets the row of the start of the run (0 if there isn't one).  Returns the lanes that found two bins in a
+    row that didn't rise.  Lanes not in the batch have lo set to 255 so they never step.  */
+
+__attribute__ ((target ("avx2")))
+static uint32_t back_scan_avx2 (RETURN_BATCH *batch, uint8_t *lo, uint8_t *start)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i one = _mm256_set1_epi8 (1);
+  const __m256i two = _mm256_set1_epi8 (2);
+  __m256i vlo = _mm256_loadu_si256 ((__m256i *) lo);
+  __m256i rise = zero, row = zero, done = zero;
+
+  for (int32_t j = HWF_BATCH_BACK ; j >= 1 ; j--)
+    {
+      __m256i vj = _mm256_set1_epi8 ((char) j);
+      __m256i cur = _mm256_loadu_si256 ((__m256i *) batch->window[j]);
+      __m256i prev = _mm256_loadu_si256 ((__m256i *) batch->window[j - 1]);
+
+      __m256i valid = _mm256_andnot_si256 (done, _mm256_cmpeq_epi8 (_mm256_max_epu8 (vj, vlo), vj));
+      __m256i no_rise = _mm256_cmpeq_epi8 (_mm256_min_epu8 (cur, prev), cur);
+      __m256i counted = _mm256_and_si256 (valid, no_rise);
+      __m256i reset = _mm256_andnot_si256 (no_rise, valid);
+
+      row = _mm256_blendv_epi8 (row, vj, _mm256_and_si256 (counted, _mm256_cmpeq_epi8 (row, zero)));
+      row = _mm256_andnot_si256 (reset, row);
+      rise = _mm256_blendv_epi8 (rise, _mm256_add_epi8 (rise, one), counted);
+      rise = _mm256_andnot_si256 (reset, rise);
+      done = _mm256_or_si256 (done, _mm256_and_si256 (counted, _mm256_cmpeq_epi8 (rise, two)));
+
+
+      //  Stop when every lane has either finished or run out of bins.
+
+      __m256i next = _mm256_sub_epi8 (vj, one);
+      __m256i going = _mm256_andnot_si256 (done, _mm256_cmpeq_epi8 (_mm256_max_epu8 (next, vlo), next));
+
+      if (!_mm256_movemask_epi8 (going)) break;
+    }
+
+  _mm256_storeu_si256 ((__m256i *) start, row);
+
+  uint32_t mask = (uint32_t) _mm256_movemask_epi8 (done);
+
+  _mm256_zeroupper ();
+
+  return (mask);
+}
+
+
+
+/*  Peak scan.  A lane steps from row HWF_BATCH_BACK (the bottom bin) up to (not including) row hi[l].  peak[l] gets the row
+    of the peak (0 if there isn't one).  Lanes not in the batch have hi set to 0.  */
+
+__attribute__ ((target ("avx2")))
+static void peak_scan_avx2 (RETURN_BATCH *batch, uint8_t *hi, uint8_t *peak)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i ones = _mm256_set1_epi8 (-1);
+  const __m256i one = _mm256_set1_epi8 (1);
+  const __m256i two = _mm256_set1_epi8 (2);
+  __m256i vhi = _mm256_loadu_si256 ((__m256i *) hi);
+  __m256i drop = zero, row = zero, done = zero;
+
+  for (int32_t j = HWF_BATCH_BACK ; j < HWF_BATCH_BACK + HWF_BATCH_AHEAD ; j++)
+    {
+      __m256i vj = _mm256_set1_epi8 ((char) j);
+      __m256i cur = _mm256_loadu_si256 ((__m256i *) batch->window[j]);
+      __m256i prev = _mm256_loadu_si256 ((__m256i *) batch->window[j - 1]);
+
+
+      //  Valid lanes haven't finished and j < hi (j >= hi is max (j, hi) == j).
+
+      __m256i past = _mm256_cmpeq_epi8 (_mm256_max_epu8 (vj, vhi), vj);
+      __m256i valid = _mm256_andnot_si256 (_mm256_or_si256 (past, done), ones);
+
+      if (!_mm256_movemask_epi8 (valid)) break;
+
+      __m256i fall = _mm256_andnot_si256 (_mm256_cmpeq_epi8 (_mm256_max_epu8 (cur, prev), cur), ones);
+      __m256i down = _mm256_and_si256 (valid, fall);
+      __m256i reset = _mm256_andnot_si256 (fall, valid);
+
+      row = _mm256_blendv_epi8 (row, vj, _mm256_and_si256 (down, _mm256_cmpeq_epi8 (row, zero)));
+      row = _mm256_andnot_si256 (reset, row);
+      drop = _mm256_blendv_epi8 (drop, _mm256_add_epi8 (drop, one), down);
+      drop = _mm256_andnot_si256 (reset, drop);
+      done = _mm256_or_si256 (done, _mm256_and_si256 (down, _mm256_cmpeq_epi8 (drop, two)));
+    }
+
+  _mm256_storeu_si256 ((__m256i *) peak, row);
+
+  _mm256_zeroupper ();
+}
+
+
+
+/*  The lanes version of the return filter (same steps as apd_return_filter, see there for the why).  */
+
+static void filter_lanes (MISC *misc, RETURN_BATCH *batch)
+{
+  uint8_t lo[HWF_BATCH_LANES], hi[HWF_BATCH_LANES], start[HWF_BATCH_LANES], peak[HWF_BATCH_LANES];
+  uint32_t todo = 0, active = 0;
+
+
+  //  The surface only depends on the waveform so a lane that shares its waveform with an earlier lane (the other return of
+  //  the same shot) takes that lane's surface.
+
+  for (int32_t l = 0 ; l < batch->count ; l++)
+    {
+      batch->lane[l].killed = NVFalse;
+      if (batch->lane[l].same < 0) todo |= (1U << l);
+    }
+
+  surface_scan_avx2 (batch, todo);
+
+  for (int32_t l = 0 ; l < batch->count ; l++)
+    if (batch->lane[l].same >= 0) batch->lane[l].surface = batch->lane[batch->lane[l].same].surface;
+
+
+  for (int32_t l = 0 ; l < HWF_BATCH_LANES ; l++)
+    {
+      lo[l] = 255;
+      hi[l] = 0;
+
+      if (l >= batch->count) continue;
+
+      RETURN_LANE *lane = &batch->lane[l];
+      uint8_t *wave = batch->wave[l];
+      int32_t bin = lane->bin;
+
+
+      //  Anything odd goes to the scalar filter.
+
+      if (bin < 1 || bin >= batch->size)
+        {
+          finish_lane (batch, l);
+          misc->batch_scalar++;
+          continue;
+        }
+
+
+      //  AC zero offset.
+
+      if (batch->ac_off_req && (wave[bin] - lane->ac_zero_offset < batch->ac_off_req))
+        {
+          lane->killed = NVTrue;
+          lane->trace.rule = HWF_RULE_AC_OFFSET;
+          lane->trace.bin = bin;
+          lane->trace.run = wave[bin] - lane->ac_zero_offset;
+          lane->trace.slope = 0.0;
+          continue;
+        }
+
+
+      //  Before the surface.
+
+      if (bin < lane->surface)
+        {
+          lane->killed = NVTrue;
+          lane->trace.rule = HWF_RULE_SURFACE;
+          lane->trace.bin = bin;
+          lane->trace.run = lane->surface;
+          lane->trace.slope = 0.0;
+          continue;
+        }
+
+
+      //  Lay out the bins around the bottom bin (anything off the ends of the waveform is never looked at).
+
+      for (int32_t j = 0 ; j < HWF_BATCH_BACK + HWF_BATCH_AHEAD ; j++)
+        {
+          int32_t i = bin + j - HWF_BATCH_BACK;
+
+          batch->window[j][l] = (i >= 0 && i < batch->size) ? wave[i] : 0;
+        }
+
+      lo[l] = qMax (1, 20 - bin + HWF_BATCH_BACK);
+      hi[l] = HWF_BATCH_BACK + qMin (HWF_BATCH_AHEAD, batch->size - 1 - bin);
+      active |= (1U << l);
+    }
+
+  if (!active) return;
+
+
+  uint32_t done = back_scan_avx2 (batch, lo, start);
+
+  peak_scan_avx2 (batch, hi, peak);
+
+
+  for (int32_t l = 0 ; l < batch->count ; l++)
+    {
+      if (!(active & (1U << l))) continue;
+
+      RETURN_LANE *lane = &batch->lane[l];
+      uint8_t *wave = batch->wave[l];
+      int32_t bin = lane->bin;
+
+
+      //  The run start scan ran out of window before it got to bin 20.
+
+      if (!(done & (1U << l)) && bin > HWF_BATCH_BACK + 19)
+        {
+          finish_lane (batch, l);
+          misc->batch_scalar++;
+          continue;
+        }
+
+      int32_t start_data = start[l] ? bin + start[l] - HWF_BATCH_BACK : 0;
+      int32_t peak_data = peak[l] ? bin + peak[l] - HWF_BATCH_BACK : 0;
+
+      int32_t run = peak_data - start_data;
+      float slope = (float) (wave[peak_data] - wave[start_data]) / (float) run;
+
+      if (run < lane->run_req || slope < batch->slope_req)
+        {
+          lane->killed = NVTrue;
+          lane->trace.rule = (run < lane->run_req) ? HWF_RULE_RUN : HWF_RULE_SLOPE;
+          lane->trace.bin = bin;
+          lane->trace.run = run;
+          lane->trace.slope = slope;
+        }
+    }
+}
+
+#endif
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        return_filter_batch                                 *
+*                                                                           *
+*   Purpose:            Run the return filter (apd_return_filter or         *
+*                       pmt_return_filter) on every return in a batch,      *
+*                       one return per lane.  The verdicts (and the trace   *
+*                       rule, bin, run, and slope) are the same as the      *
+*                       scalar filter's.  The caller must only add returns  *
+*                       that are going to be checked (not Shallow Water     *
+*                       Algorithm, Shoreline Depth Swapped, or land).       *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       batch          - the batch (lane[].killed,          *
+*                                        surface, and trace are set)        *
+*                                                                           *
+*   Return Value:       None                                                *
+*                                                                           *
+\***************************************************************************/
+
+void return_filter_batch (MISC *misc, RETURN_BATCH *batch)
+{
+  misc->batch_lanes += batch->count;
+
+#ifdef HWF_X86
+
+  static const int32_t have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+
+  if (have_avx2)
+    {
+      filter_lanes (misc, batch);
+      return;
+    }
+
+#endif
+
+  for (int32_t l = 0 ; l < batch->count ; l++)
+    {
+      RETURN_LANE *lane = &batch->lane[l];
+
+      lane->surface = (lane->same >= 0) ? batch->lane[lane->same].surface : -1;
+
+      finish_lane (batch, l);
+    }
+
+  misc->batch_scalar += batch->count;
+}
@@ -0,0 +1,185 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "hofWaveFilter.hpp"
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        open_shot_files                                     *
+*                                                                           *
+*   Purpose:            Open the INH file (and optionally the HOF file)     *
+*                       that a point came from and read the headers.  With  *
+*                       a synthetic point cloud nothing is opened, we just  *
+*                       pick up the AC zero offsets.                        *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       ndx            - misc->data index of the point      *
+*                       hof            - set to open the HOF file as well   *
+*                       files          - the open files                     *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error (nothing is left  *
+*                                        open)                              *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t open_shot_files (MISC *misc, int32_t ndx, uint8_t hof, SHOT_FILES *files, char *progname)
+{
+  char               hof_file[512], wave_file[512];
+  HOF_HEADER_T       hof_header;
+  WAVE_HEADER_T      wave_header;
+
+
+  files->hof_fp = NULL;
+  files->wave_fp = NULL;
+  files->hof_geom.rec = files->wave_geom.rec = -1;
+  files->hof_geom.size = files->wave_geom.size = 0;
+  files->ahead = 0;
+
+  if (misc->synthetic)
+    {
+      files->pmt_ac_zero_offset = misc->synthetic[ndx].pmt_ac_zero_offset;
+      files->apd_ac_zero_offset = misc->synthetic[ndx].apd_ac_zero_offset;
+      return (NVTrue);
+    }
+
+
+  //  Get the HOF file name from the PFM list (.ctl) file.
+
+  int16_t type;
+  read_list_file (misc->pfm_handle[misc->data[ndx].pfm], misc->data[ndx].file, hof_file, &type);
+
+
+  //  Open the HOF file.
+
+  if (hof)
+    {
+      if ((files->hof_fp = open_hof_file (hof_file)) == NULL)
+        {
+          perror (hof_file);
+          return (NVFalse);
+        }
+
+      hof_read_header (files->hof_fp, &hof_header);
+    }
+
+
+  //  Construct the INH file name and open the INH file.
+
+  strcpy (wave_file, hof_file);
+  sprintf (&wave_file[strlen (wave_file) - 4], ".inh");
+
+  if ((files->wave_fp = open_wave_file (wave_file)) == NULL)
+    {
+      perror (wave_file);
+      close_shot_files (files);
+      return (NVFalse);
+    }
+
+
+  //  Read the INH header
+
+  wave_read_header (files->wave_fp, &wave_header);
+
+  files->pmt_ac_zero_offset = wave_header.ac_zero_offset[PMT];
+  files->apd_ac_zero_offset = wave_header.ac_zero_offset[APD];
+
+
+  //  We're assuming that the waveform sizes are constant.  This error should never happen.
+
+  if (wave_header.apd_size != HWF_APD_SIZE || wave_header.pmt_size != HWF_PMT_SIZE)
+    {
+      fprintf (stderr, "%s %s %s %d - Bad APD (%d) or PMT (%d) array length in file %s\n", progname, __FILE__, __FUNCTION__, __LINE__,
+               wave_header.apd_size, wave_header.pmt_size, wave_file);
+      close_shot_files (files);
+      return (NVFalse);
+    }
+
+
+  return (NVTrue);
+}
+
+
+
+void close_shot_files (SHOT_FILES *files)
+{
+  if (files->hof_fp) fclose (files->hof_fp);
+  if (files->wave_fp) fclose (files->wave_fp);
+
+  files->hof_fp = NULL;
+  files->wave_fp = NULL;
+}
+
+
+
+/*  Read the HOF record for a point (the HOF file must have been opened).  */
+
+void read_shot_record (MISC *misc, SHOT_FILES *files, int32_t ndx, HYDRO_OUTPUT_T *hof_record)
+{
+  if (misc->synthetic)
+    {
+      SYNTHETIC_SHOT *shot = &misc->synthetic[ndx];
+
+      memset (hof_record, 0, sizeof (HYDRO_OUTPUT_T));
+
+      hof_record->abdc = shot->abdc;
+      hof_record->sec_abdc = shot->sec_abdc;
+      hof_record->bot_channel = shot->bot_channel;
+      hof_record->sec_bot_chan = shot->sec_bot_chan;
+      hof_record->calc_bot_run_required[0] = shot->calc_bot_run_required[0];
+      hof_record->calc_bot_run_required[1] = shot->calc_bot_run_required[1];
+      hof_record->bot_bin_first = shot->bot_bin_first;
+      hof_record->bot_bin_second = shot->bot_bin_second;
+
+      return;
+    }
+
+  hof_read_record (files->hof_fp, misc->data[ndx].rec, hof_record);
+
+  if (misc->io_depth) note_shot_read (&files->hof_geom, files->hof_fp, misc->data[ndx].rec);
+}
+
+
+
+/*  Read the INH record for a point into wave_rec and point apd and pmt at its waveforms.  The waveforms are used where they
+    are, they aren't copied.  Synthetic shots aren't read at all, apd and pmt point at the shot's own waveforms.  */
+
+void read_shot_waveform (MISC *misc, SHOT_FILES *files, int32_t ndx, WAVE_DATA_T *wave_rec, uint8_t **apd, uint8_t **pmt)
+{
+  if (misc->synthetic)
+    {
+      *apd = misc->synthetic[ndx].apd;
+      *pmt = misc->synthetic[ndx].pmt;
+
+      return;
+    }
+
+  wave_read_record (files->wave_fp, misc->data[ndx].rec, wave_rec);
+
+  if (misc->io_depth) note_shot_read (&files->wave_geom, files->wave_fp, misc->data[ndx].rec);
+
+  *apd = wave_rec->apd;
+  *pmt = wave_rec->pmt;
+}
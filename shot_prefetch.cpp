@@ -0,0 +1,422 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+#ifdef NVLinux
+#include <fcntl.h>
+#if defined (__has_include)
+#if __has_include (<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined (__NR_io_uring_setup) && defined (__NR_io_uring_enter)
+#define HWF_IO_URING
+#endif
+#endif
+#endif
+#endif
+
+
+//  The HOF and INH records still have to be read one at a time through the CHARTS readers (they do the decoding) so all we
+//  can do is get the records into the page cache before the readers ask for them.  The records are read in sorted order
+//  so we know which ones are coming.  With io_uring we put the reads for the next misc->io_depth records (HOF and INH) into
+//  the submission queue and hand them all to the kernel at once.  The data goes into a set of scratch buffers that we never
+//  look at, it's the page cache we're after.  Without io_uring (or if the kernel won't give us one) we ask for the same
+//  ranges with posix_fadvise, which starts the reads but doesn't let us keep as many going.
+
+#ifdef HWF_IO_URING
+
+struct SHOT_RING
+{
+  int32_t     fd;
+  uint32_t    *sq_head;
+  uint32_t    *sq_tail;
+  uint32_t    *sq_mask;
+  uint32_t    *sq_array;
+  uint32_t    *cq_head;
+  uint32_t    *cq_tail;
+  uint32_t    *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void        *sq_map;
+  void        *cq_map;
+  size_t      sq_map_size;
+  size_t      cq_map_size;
+  size_t      sqe_map_size;
+  uint8_t     *buffer;                   //  One HWF_IO_SLOT buffer per slot
+  int32_t     *free_slot;                //  Free buffer slots
+  int32_t     free_count;
+  int32_t     slot_count;
+  int32_t     pending;                   //  Queued but not yet submitted
+  int32_t     inflight;                  //  Submitted but not yet completed
+};
+
+
+static void close_ring (SHOT_RING *ring)
+{
+  if (ring->sqes != MAP_FAILED && ring->sqes) munmap (ring->sqes, ring->sqe_map_size);
+  if (ring->cq_map != MAP_FAILED && ring->cq_map && ring->cq_map != ring->sq_map) munmap (ring->cq_map, ring->cq_map_size);
+  if (ring->sq_map != MAP_FAILED && ring->sq_map) munmap (ring->sq_map, ring->sq_map_size);
+  if (ring->fd >= 0) close (ring->fd);
+  if (ring->buffer) free (ring->buffer);
+  if (ring->free_slot) free (ring->free_slot);
+  free (ring);
+}
+
+
+static SHOT_RING *open_ring (int32_t slot_count)
+{
+  struct io_uring_params params;
+
+  SHOT_RING *ring = (SHOT_RING *) calloc (1, sizeof (SHOT_RING));
+  if (ring == NULL) return (NULL);
+
+  memset (&params, 0, sizeof (params));
+
+  ring->fd = (int32_t) syscall (__NR_io_uring_setup, slot_count, &params);
+  if (ring->fd < 0)
+    {
+      free (ring);
+      return (NULL);
+    }
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+  ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  ring->sqe_map_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) ring->sq_map_size = ring->cq_map_size = qMax (ring->sq_map_size, ring->cq_map_size);
+
+  ring->sq_map = mmap (NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      ring->cq_map = ring->sq_map;
+    }
+  else
+    {
+      ring->cq_map = mmap (NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+
+  ring->sqes = (struct io_uring_sqe *) mmap (NULL, ring->sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                                             IORING_OFF_SQES);
+
+  ring->slot_count = slot_count;
+  ring->buffer = (uint8_t *) malloc ((size_t) slot_count * HWF_IO_SLOT);
+  ring->free_slot = (int32_t *) malloc (slot_count * sizeof (int32_t));
+
+  if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED || ring->buffer == NULL ||
+      ring->free_slot == NULL)
+    {
+      close_ring (ring);
+      return (NULL);
+    }
+
+  uint8_t *sq = (uint8_t *) ring->sq_map;
+  uint8_t *cq = (uint8_t *) ring->cq_map;
+
+  ring->sq_head = (uint32_t *) (sq + params.sq_off.head);
+  ring->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+  ring->sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (uint32_t *) (sq + params.sq_off.array);
+  ring->cq_head = (uint32_t *) (cq + params.cq_off.head);
+  ring->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+  ring->cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  for (int32_t i = 0 ; i < slot_count ; i++) ring->free_slot[i] = i;
+  ring->free_count = slot_count;
+
+
+  return (ring);
+}
+
+
+/*  Take the finished reads off the completion queue and free up their buffers.  We don't care how the reads came out.  */
+
+static void reap_ring (SHOT_RING *ring)
+{
+  uint32_t head = *ring->cq_head;
+
+  while (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+      ring->free_slot[ring->free_count] = (int32_t) ring->cqes[head & *ring->cq_mask].user_data;
+      ring->free_count++;
+      ring->inflight--;
+      head++;
+    }
+
+  __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+static void submit_ring (SHOT_RING *ring)
+{
+  if (!ring->pending) return;
+
+  syscall (__NR_io_uring_enter, ring->fd, ring->pending, 0, 0, NULL, 0);
+
+  ring->pending = 0;
+}
+
+
+/*  Queue a read (NVFalse if all of the buffers are busy).  */
+
+static uint8_t queue_read (SHOT_RING *ring, int32_t fd, int64_t offset, int32_t length)
+{
+  if (!ring->free_count) reap_ring (ring);
+  if (!ring->free_count) return (NVFalse);
+
+  ring->free_count--;
+  int32_t slot = ring->free_slot[ring->free_count];
+
+  uint32_t tail = *ring->sq_tail;
+  uint32_t index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = (uint64_t) (uintptr_t) &ring->buffer[(size_t) slot * HWF_IO_SLOT];
+  sqe->len = length;
+  sqe->user_data = slot;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  ring->pending++;
+  ring->inflight++;
+
+
+  return (NVTrue);
+}
+
+#else
+
+struct SHOT_RING
+{
+  int32_t     fd;
+};
+
+#endif
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        start_prefetch                                      *
+*                                                                           *
+*   Purpose:            Set up the read ahead.  Uses io_uring if we have    *
+*                       it and the kernel will give us one, otherwise       *
+*                       prefetch_shots falls back to posix_fadvise.         *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                                                                           *
+*   Return Value:       None                                                *
+*                                                                           *
+\***************************************************************************/
+
+void start_prefetch (MISC *misc)
+{
+  misc->io_ring = NULL;
+
+  if (!misc->io_depth || misc->synthetic) return;
+
+#ifdef HWF_IO_URING
+
+  //  Each record can need a HOF read and an INH read.
+
+  misc->io_ring = open_ring (misc->io_depth * 2);
+
+#endif
+}
+
+
+
+/*  Wait for the reads that are still going and get rid of the ring.  */
+
+void stop_prefetch (MISC *misc)
+{
+  if (misc->io_ring == NULL) return;
+
+#ifdef HWF_IO_URING
+
+  SHOT_RING *ring = misc->io_ring;
+
+  submit_ring (ring);
+
+  while (ring->inflight)
+    {
+      if (syscall (__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) break;
+      reap_ring (ring);
+    }
+
+  close_ring (ring);
+
+#endif
+
+  misc->io_ring = NULL;
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        note_shot_read                                      *
+*                                                                           *
+*   Purpose:            Work out the record size of a HOF or INH file from  *
+*                       where the file is after a read.  The first read     *
+*                       gives us one record's end and the next read of a    *
+*                       different record gives us the size.  If the records *
+*                       don't line up the size is set to -1 and that file   *
+*                       isn't read ahead.                                   *
+*                                                                           *
+*   Arguments:          geom           - the file's record layout           *
+*                       fp             - the file (just after the read)     *
+*                       rec            - the record that was read           *
+*                                                                           *
+*   Return Value:       None                                                *
+*                                                                           *
+\***************************************************************************/
+
+void note_shot_read (SHOT_GEOMETRY *geom, FILE *fp, int32_t rec)
+{
+  if (geom->size) return;
+
+  int64_t end = (int64_t) ftello (fp);
+
+  if (geom->rec < 0)
+    {
+      geom->rec = rec;
+      geom->end = end;
+      return;
+    }
+
+  if (rec == geom->rec) return;
+
+  int64_t size = (end - geom->end) / (rec - geom->rec);
+
+  if (size <= 0 || (end - geom->end) % (rec - geom->rec) || geom->end - size < 0) size = -1;
+
+  geom->size = size;
+}
+
+
+
+/*  Read ahead one record of a file.  NVFalse if we have to stop for now (no room in the ring or we don't know where the
+    records are yet).  */
+
+static uint8_t prefetch_record (MISC *misc, FILE *fp, SHOT_GEOMETRY *geom, int32_t rec)
+{
+  if (fp == NULL || geom->size < 0) return (NVTrue);
+  if (!geom->size) return (NVFalse);
+
+  int64_t offset = geom->end + (int64_t) (rec - geom->rec - 1) * geom->size;
+  int32_t length = (int32_t) qMin (geom->size, (int64_t) HWF_IO_SLOT);
+
+  if (offset < 0) return (NVTrue);
+
+#ifdef HWF_IO_URING
+
+  if (misc->io_ring)
+    {
+      if (!queue_read (misc->io_ring, fileno (fp), offset, length)) return (NVFalse);
+
+      misc->io_reads++;
+      return (NVTrue);
+    }
+
+#endif
+
+#ifdef NVLinux
+
+  posix_fadvise (fileno (fp), offset, length, POSIX_FADV_WILLNEED);
+  misc->io_reads++;
+
+#endif
+
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        prefetch_shots                                      *
+*                                                                           *
+*   Purpose:            Start reading the records for the entries after     *
+*                       entry i of a sorted read list (up to misc->io_depth *
+*                       entries ahead, in the same files as entry i).  The  *
+*                       HOF record is read ahead if the HOF file is open    *
+*                       and the INH record is read ahead unless the point   *
+*                       is invalid (it won't be checked).  Call this after  *
+*                       reading entry i.                                    *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       files          - the open files for entry i         *
+*                       wave_data      - the per point data                 *
+*                       sa             - the sorted read list (rec is the   *
+*                                        wave_data index)                   *
+*                       count          - number of entries in sa            *
+*                       i              - the entry that was just read       *
+*                                                                           *
+*   Return Value:       None                                                *
+*                                                                           *
+\***************************************************************************/
+
+void prefetch_shots (MISC *misc, SHOT_FILES *files, WAVE_DATA *wave_data, SORT_REC *sa, int32_t count, int32_t i)
+{
+  if (!misc->io_depth || misc->synthetic) return;
+
+  int32_t j = qMax (files->ahead, i + 1);
+  int32_t end = qMin (count, i + 1 + misc->io_depth);
+
+  for ( ; j < end && sa[j].pfm_file == sa[i].pfm_file ; j++)
+    {
+      int32_t ndx = wave_data[sa[j].rec].ndx;
+
+      if (misc->data[ndx].type != PFM_CHARTS_HOF_DATA) continue;
+
+
+      //  The other return of a shot doesn't need to be read again.
+
+      if (sa[j].pfm_file == sa[j - 1].pfm_file && sa[j].orig_rec == sa[j - 1].orig_rec) continue;
+
+      if (!prefetch_record (misc, files->hof_fp, &files->hof_geom, misc->data[ndx].rec)) break;
+
+      if (!(misc->data[ndx].val & PFM_INVAL) || files->hof_fp == NULL)
+        {
+          if (!prefetch_record (misc, files->wave_fp, &files->wave_geom, misc->data[ndx].rec)) break;
+        }
+    }
+
+  files->ahead = j;
+
+#ifdef HWF_IO_URING
+
+  if (misc->io_ring) submit_ring (misc->io_ring);
+
+#endif
+}
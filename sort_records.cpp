@@ -0,0 +1,101 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  The 64 bit sort key of a record, PFM/file number in the high half and original record number in the low half.  The sign
+//  bits are flipped so that the unsigned key order is the same as the signed order of the numbers.
+
+static inline uint64_t record_key (SORT_REC *rec)
+{
+  return (((uint64_t) ((uint32_t) rec->pfm_file ^ 0x80000000U) << 32) | (uint64_t) ((uint32_t) rec->orig_rec ^ 0x80000000U));
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        sort_records                                        *
+*                                                                           *
+*   Purpose:            Sort records by PFM/file number and then by         *
+*                       original record number so that each file is read    *
+*                       in order.  This is an LSD radix sort on the packed  *
+*                       64 bit key, a byte at a time.  The counts for all   *
+*                       eight bytes are taken in one pass and any byte that *
+*                       is the same for every key (most of the high bytes   *
+*                       usually are) is skipped.  It's stable so records    *
+*                       with the same key (the two returns of a shot) stay  *
+*                       in the order they were given in.                    *
+*                                                                           *
+*   Arguments:          sa             - the records                        *
+*                       count          - number of records                  *
+*                       temp           - scratch space for count records    *
+*                                                                           *
+*   Return Value:       None                                                *
+*                                                                           *
+\***************************************************************************/
+
+void sort_records (SORT_REC *sa, int32_t count, SORT_REC *temp)
+{
+  int32_t hist[8][256];
+
+
+  if (count < 2) return;
+
+  memset (hist, 0, sizeof (hist));
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      uint64_t key = record_key (&sa[i]);
+
+      for (int32_t d = 0 ; d < 8 ; d++) hist[d][(key >> (d * 8)) & 0xff]++;
+    }
+
+
+  SORT_REC *from = sa, *to = temp;
+
+  for (int32_t d = 0 ; d < 8 ; d++)
+    {
+      //  Every key has the same value in this byte so it wouldn't move anything.
+
+      if (hist[d][(record_key (&from[0]) >> (d * 8)) & 0xff] == count) continue;
+
+
+      int32_t offset[256], sum = 0;
+
+      for (int32_t b = 0 ; b < 256 ; b++)
+        {
+          offset[b] = sum;
+          sum += hist[d][b];
+        }
+
+      for (int32_t i = 0 ; i < count ; i++) to[offset[(record_key (&from[i]) >> (d * 8)) & 0xff]++] = from[i];
+
+      SORT_REC *swap = from;
+      from = to;
+      to = swap;
+    }
+
+  if (from != sa) memcpy (sa, from, count * sizeof (SORT_REC));
+}
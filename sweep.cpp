@@ -0,0 +1,366 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  One set of filter settings for --sweep.  Anything that isn't given in the set is left at the value from pfmEdit.
+
+typedef struct
+{
+  FILTER_SHARE filter;                   //  search_radius, search_width, rise_threshold, and the AC zero offsets required
+  float       slope_req;                 //  Return filter slope required
+} SWEEP_SET;
+
+
+/*  Read the parameter sets.  Each line that isn't blank or a # comment is a set of name=value pairs.  */
+
+static int32_t read_sweep_sets (MISC *misc, char *file, SWEEP_SET **sets, char *progname)
+{
+  FILE *fp;
+  char string[1024];
+  int32_t count = 0, line = 0;
+
+
+  *sets = NULL;
+
+  if ((fp = fopen (file, "r")) == NULL)
+    {
+      perror (file);
+      return (-1);
+    }
+
+  while (fgets (string, sizeof (string), fp) != NULL)
+    {
+      line++;
+
+      char *token = strtok (string, " \t\r\n");
+
+      if (token == NULL || token[0] == '#') continue;
+
+
+      SWEEP_SET *new_sets = (SWEEP_SET *) realloc (*sets, (count + 1) * sizeof (SWEEP_SET));
+      if (new_sets == NULL)
+        {
+          perror ("Allocating parameter sets in sweep.cpp");
+          fclose (fp);
+          return (-1);
+        }
+
+      *sets = new_sets;
+
+      SWEEP_SET *set = &(*sets)[count];
+
+      set->filter = misc->abe_share->filterShare;
+      set->slope_req = misc->slope_req;
+
+      for ( ; token != NULL ; token = strtok (NULL, " \t\r\n"))
+        {
+          char name[128];
+          double value;
+
+          if (sscanf (token, "%127[^=]=%lf", name, &value) != 2)
+            {
+              fprintf (stderr, "%s - %s line %d - expected name=value, got %s\n", progname, file, line, token);
+              fclose (fp);
+              return (-1);
+            }
+
+
+          //  The bin grid is sized from the search radius and the waveform check window from the search width.
+
+          if ((!strcmp (name, "search_radius") && value <= 0.0) || (!strcmp (name, "search_width") && value < 0.0))
+            {
+              fprintf (stderr, "%s - %s line %d - %s out of range (%g)\n", progname, file, line, name, value);
+              fclose (fp);
+              return (-1);
+            }
+
+          if (!strcmp (name, "search_radius"))
+            {
+              set->filter.search_radius = value;
+            }
+          else if (!strcmp (name, "search_width"))
+            {
+              set->filter.search_width = NINT (value);
+            }
+          else if (!strcmp (name, "rise_threshold"))
+            {
+              set->filter.rise_threshold = NINT (value);
+            }
+          else if (!strcmp (name, "apd_ac_zero_offset_required"))
+            {
+              set->filter.apd_ac_zero_offset_required = NINT (value);
+            }
+          else if (!strcmp (name, "pmt_ac_zero_offset_required"))
+            {
+              set->filter.pmt_ac_zero_offset_required = NINT (value);
+            }
+          else if (!strcmp (name, "slope_req"))
+            {
+              set->slope_req = (float) value;
+            }
+          else
+            {
+              fprintf (stderr, "%s - %s line %d - unknown parameter %s\n", progname, file, line, name);
+              fclose (fp);
+              return (-1);
+            }
+        }
+
+      count++;
+    }
+
+  fclose (fp);
+
+
+  return (count);
+}
+
+
+
+/*  Read the HOF and INH records of every HOF point once and keep them in misc->synthetic so that every parameter set is
+    filtered from memory (see shot_io.cpp).  The two returns of a shot are read once.  */
+
+static uint8_t load_shots (MISC *misc, char *progname)
+{
+  SHOT_FILES         files;
+  HYDRO_OUTPUT_T     hof_record;
+  WAVE_DATA_T        wave_rec;
+  uint8_t            *apd, *pmt;
+  int32_t            count = misc->abe_share->point_cloud_count;
+
+
+  SYNTHETIC_SHOT *shot = (SYNTHETIC_SHOT *) calloc (qMax (count, 1), sizeof (SYNTHETIC_SHOT));
+  SORT_REC *sa = (SORT_REC *) malloc (2 * qMax (count, 1) * sizeof (SORT_REC));
+  if (shot == NULL || sa == NULL)
+    {
+      perror ("Allocating shots in sweep.cpp");
+      if (shot) free (shot);
+      if (sa) free (sa);
+      return (NVFalse);
+    }
+
+  int32_t read_count = 0;
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      if (misc->data[i].type != PFM_CHARTS_HOF_DATA) continue;
+
+      sa[read_count].pfm_file = misc->data[i].pfm * PFM_MAX_FILES + misc->data[i].file;
+      sa[read_count].orig_rec = misc->data[i].rec;
+      sa[read_count].rec = i;
+      read_count++;
+    }
+
+  sort_records (sa, read_count, sa + qMax (count, 1));
+
+
+  files.hof_fp = files.wave_fp = NULL;
+  int32_t prev_pfm_file = -999;
+
+  for (int32_t i = 0 ; i < read_count ; i++)
+    {
+      int32_t ndx = sa[i].rec;
+
+      if (sa[i].pfm_file != prev_pfm_file)
+        {
+          close_shot_files (&files);
+
+          if (!open_shot_files (misc, ndx, NVTrue, &files, progname))
+            {
+              free (shot);
+              free (sa);
+              return (NVFalse);
+            }
+
+          prev_pfm_file = sa[i].pfm_file;
+        }
+
+
+      //  Same shot as the last one (the other return).
+
+      if (i && sa[i].pfm_file == sa[i - 1].pfm_file && sa[i].orig_rec == sa[i - 1].orig_rec)
+        {
+          shot[ndx] = shot[sa[i - 1].rec];
+          continue;
+        }
+
+      read_shot_record (misc, &files, ndx, &hof_record);
+      read_shot_waveform (misc, &files, ndx, &wave_rec, &apd, &pmt);
+      misc->hof_reads++;
+      misc->wave_reads++;
+
+      shot[ndx].abdc = hof_record.abdc;
+      shot[ndx].sec_abdc = hof_record.sec_abdc;
+      shot[ndx].bot_channel = hof_record.bot_channel;
+      shot[ndx].sec_bot_chan = hof_record.sec_bot_chan;
+      shot[ndx].calc_bot_run_required[0] = hof_record.calc_bot_run_required[0];
+      shot[ndx].calc_bot_run_required[1] = hof_record.calc_bot_run_required[1];
+      shot[ndx].bot_bin_first = hof_record.bot_bin_first;
+      shot[ndx].bot_bin_second = hof_record.bot_bin_second;
+      shot[ndx].pmt_ac_zero_offset = files.pmt_ac_zero_offset;
+      shot[ndx].apd_ac_zero_offset = files.apd_ac_zero_offset;
+      memcpy (shot[ndx].apd, apd, HWF_APD_SIZE);
+      memcpy (shot[ndx].pmt, pmt, HWF_PMT_SIZE);
+    }
+
+  close_shot_files (&files);
+
+  free (sa);
+
+  misc->synthetic = shot;
+
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        sweep_filter                                        *
+*                                                                           *
+*   Purpose:            Run the filter once for each set of settings in a   *
+*                       parameter file (--sweep) and report what each set   *
+*                       would kill, without changing the point cloud.  The  *
+*                       HOF and INH records are read once up front (about   *
+*                       0.7 KB per HOF point) and every set is filtered     *
+*                       from memory.  The bin grid is rebuilt for each set  *
+*                       since its size comes from the search radius.  A     *
+*                       line per set goes to stderr and the killed points   *
+*                       go to stdout, one per line:                         *
+*                                                                           *
+*                       set index pfm file line record return               *
+*                                                                           *
+*                       The parameter names are search_radius,              *
+*                       search_width, rise_threshold, slope_req,            *
+*                       apd_ac_zero_offset_required, and                    *
+*                       pmt_ac_zero_offset_required.                        *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       file           - the parameter file                 *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t sweep_filter (MISC *misc, char *file, char *progname)
+{
+  SWEEP_SET *sets;
+  int32_t count = misc->abe_share->point_cloud_count;
+  uint8_t status = NVTrue;
+  QElapsedTimer timer;
+
+
+  int32_t set_count = read_sweep_sets (misc, file, &sets, progname);
+
+  if (set_count <= 0)
+    {
+      if (!set_count) fprintf (stderr, "%s - no parameter sets in %s\n", progname, file);
+      if (sets) free (sets);
+      return (NVFalse);
+    }
+
+
+  uint8_t *original = (uint8_t *) malloc (qMax (count, 1));
+  if (original == NULL)
+    {
+      perror ("Allocating sweep memory in sweep.cpp");
+      free (sets);
+      return (NVFalse);
+    }
+
+  for (int32_t i = 0 ; i < count ; i++) original[i] = misc->data[i].exflag;
+
+
+  timer.start ();
+
+  if (!load_shots (misc, progname))
+    {
+      free (original);
+      free (sets);
+      return (NVFalse);
+    }
+
+  fprintf (stderr, "%s - sweep: read the shots in %.3f ms\n", progname, (double) timer.nsecsElapsed () / 1.0e6);
+
+
+  //  The settings are changed in ABE_SHARE while we work (that's where the filter looks for them) and put back when we're done.
+
+  FILTER_SHARE filter = misc->abe_share->filterShare;
+  float slope_req = misc->slope_req;
+
+  for (int32_t s = 0 ; s < set_count ; s++)
+    {
+      misc->abe_share->filterShare = sets[s].filter;
+      misc->slope_req = sets[s].slope_req;
+
+      for (int32_t i = 0 ; i < count ; i++) misc->data[i].exflag = original[i];
+
+      timer.start ();
+
+      if (!filter_area (misc, progname))
+        {
+          status = NVFalse;
+          break;
+        }
+
+      int32_t killed = 0;
+
+      for (int32_t i = 0 ; i < count ; i++)
+        {
+          if (misc->data[i].exflag && !original[i])
+            {
+              POINT_CLOUD *point = &misc->data[i];
+
+              printf ("%d %d %d %d %d %d %d\n", s + 1, i, point->pfm, point->file, point->line, point->rec, point->sub);
+              killed++;
+            }
+        }
+
+      fprintf (stderr, "%s - sweep set %d: search_radius %.3f search_width %d rise_threshold %d slope_req %.3f "
+               "apd_ac_zero_offset_required %d pmt_ac_zero_offset_required %d - %d killed, %.3f ms\n", progname, s + 1,
+               (double) sets[s].filter.search_radius, sets[s].filter.search_width, sets[s].filter.rise_threshold,
+               (double) sets[s].slope_req, sets[s].filter.apd_ac_zero_offset_required, sets[s].filter.pmt_ac_zero_offset_required,
+               killed, (double) timer.nsecsElapsed () / 1.0e6);
+    }
+
+  fflush (stdout);
+
+
+  misc->abe_share->filterShare = filter;
+  misc->slope_req = slope_req;
+
+  for (int32_t i = 0 ; i < count ; i++) misc->data[i].exflag = original[i];
+
+  free (misc->synthetic);
+  misc->synthetic = NULL;
+
+  free (original);
+  free (sets);
+
+
+  return (status);
+}
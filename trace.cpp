@@ -0,0 +1,276 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "hofWaveFilter.hpp"
+
+
+//  Trace file layout (native byte order, the file is meant to be decoded on the machine that wrote it):
+//
+//      TRACE_HEADER
+//      for each thread:  TRACE_THREAD followed by TRACE_THREAD.count TRACE_REC records (oldest first)
+
+typedef struct
+{
+  char        magic[4];                  //  "HWFT"
+  int32_t     version;                   //  HWF_TRACE_VERSION
+  int32_t     threads;                   //  Number of rings
+  int32_t     rec_size;                  //  sizeof (TRACE_REC)
+} TRACE_HEADER;
+
+typedef struct
+{
+  int64_t     total;                     //  Records written by the thread
+  int32_t     count;                     //  Records saved in the file (the last count of total)
+  int32_t     pad;
+} TRACE_THREAD;
+
+
+static const char *rule_name[HWF_RULES] = {"none", "ac_offset", "surface", "run", "slope", "one_line", "isolation", "no_rise", "rise"};
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        trace_init                                          *
+*                                                                           *
+*   Purpose:            Allocate the decision trace rings.                  *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       threads        - number of rings (one per thread)   *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on memory error            *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t trace_init (MISC *misc, int32_t threads)
+{
+  misc->trace_threads = qMax (threads, 1);
+
+  misc->trace = (TRACE_RING *) calloc (misc->trace_threads, sizeof (TRACE_RING));
+  if (misc->trace == NULL)
+    {
+      perror ("Allocating trace rings in trace.cpp");
+      misc->trace_threads = 0;
+      return (NVFalse);
+    }
+
+  for (int32_t i = 0 ; i < misc->trace_threads ; i++)
+    {
+      misc->trace[i].rec = (TRACE_REC *) malloc (HWF_TRACE_SIZE * sizeof (TRACE_REC));
+      if (misc->trace[i].rec == NULL)
+        {
+          perror ("Allocating trace ring in trace.cpp");
+          trace_free (misc);
+          return (NVFalse);
+        }
+
+      misc->trace[i].total = 0;
+    }
+
+  return (NVTrue);
+}
+
+
+
+/*  Add a record to a thread's ring (overwriting the oldest record if the ring is full).  Only called when misc->trace is set.  */
+
+void trace_record (MISC *misc, int32_t thread, TRACE_REC *rec)
+{
+  TRACE_RING *ring = &misc->trace[thread];
+
+  ring->rec[ring->total & (HWF_TRACE_SIZE - 1)] = *rec;
+  ring->total++;
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        trace_dump                                          *
+*                                                                           *
+*   Purpose:            Write the decision trace rings to a file and free   *
+*                       them.                                               *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       file           - trace file name                    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t trace_dump (MISC *misc, char *file)
+{
+  FILE *fp;
+  uint8_t status = NVTrue;
+
+
+  if ((fp = fopen (file, "wb")) == NULL)
+    {
+      perror (file);
+      status = NVFalse;
+    }
+  else
+    {
+      TRACE_HEADER header;
+
+      memcpy (header.magic, "HWFT", 4);
+      header.version = HWF_TRACE_VERSION;
+      header.threads = misc->trace_threads;
+      header.rec_size = sizeof (TRACE_REC);
+
+      if (fwrite (&header, sizeof (TRACE_HEADER), 1, fp) != 1) status = NVFalse;
+
+      for (int32_t i = 0 ; i < misc->trace_threads && status ; i++)
+        {
+          TRACE_RING *ring = &misc->trace[i];
+          TRACE_THREAD thread;
+
+          thread.total = ring->total;
+          thread.count = (int32_t) qMin (ring->total, (int64_t) HWF_TRACE_SIZE);
+          thread.pad = 0;
+
+          if (fwrite (&thread, sizeof (TRACE_THREAD), 1, fp) != 1) status = NVFalse;
+
+
+          //  Oldest first.  If the ring has wrapped the oldest record is the next one that would have been overwritten.
+
+          int64_t first = ring->total - thread.count;
+
+          for (int64_t j = first ; j < ring->total && status ; j++)
+            {
+              if (fwrite (&ring->rec[j & (HWF_TRACE_SIZE - 1)], sizeof (TRACE_REC), 1, fp) != 1) status = NVFalse;
+            }
+        }
+
+      if (!status) perror (file);
+
+      fclose (fp);
+    }
+
+
+  trace_free (misc);
+
+  return (status);
+}
+
+
+
+/*  Free the decision trace rings.  */
+
+void trace_free (MISC *misc)
+{
+  if (!misc->trace) return;
+
+  for (int32_t i = 0 ; i < misc->trace_threads ; i++) if (misc->trace[i].rec) free (misc->trace[i].rec);
+  free (misc->trace);
+
+  misc->trace = NULL;
+  misc->trace_threads = 0;
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        decode_trace                                        *
+*                                                                           *
+*   Purpose:            Print a trace file written by trace_dump (one line  *
+*                       per record followed by a count of each rule).       *
+*                                                                           *
+*   Arguments:          file           - trace file name                    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on error                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t decode_trace (char *file)
+{
+  FILE *fp;
+  TRACE_HEADER header;
+  int64_t rule_count[HWF_RULES][2];
+
+
+  if ((fp = fopen (file, "rb")) == NULL)
+    {
+      perror (file);
+      return (NVFalse);
+    }
+
+  if (fread (&header, sizeof (TRACE_HEADER), 1, fp) != 1 || memcmp (header.magic, "HWFT", 4) || header.version != HWF_TRACE_VERSION ||
+      header.rec_size != (int32_t) sizeof (TRACE_REC))
+    {
+      fprintf (stderr, "%s is not a version %d hofWaveFilter trace file\n", file, HWF_TRACE_VERSION);
+      fclose (fp);
+      return (NVFalse);
+    }
+
+  memset (rule_count, 0, sizeof (rule_count));
+
+  printf ("# thread point rule result channel bin run neighbors slope\n");
+
+  for (int32_t i = 0 ; i < header.threads ; i++)
+    {
+      TRACE_THREAD thread;
+
+      if (fread (&thread, sizeof (TRACE_THREAD), 1, fp) != 1)
+        {
+          fprintf (stderr, "%s - truncated trace file\n", file);
+          fclose (fp);
+          return (NVFalse);
+        }
+
+      if (thread.total > thread.count)
+        printf ("# thread %d - %" PRId64 " records written, only the last %d were kept\n", i, thread.total, thread.count);
+
+      for (int32_t j = 0 ; j < thread.count ; j++)
+        {
+          TRACE_REC rec;
+
+          if (fread (&rec, sizeof (TRACE_REC), 1, fp) != 1)
+            {
+              fprintf (stderr, "%s - truncated trace file\n", file);
+              fclose (fp);
+              return (NVFalse);
+            }
+
+          int32_t rule = rec.rule < HWF_RULES ? rec.rule : 0;
+
+          printf ("%d %d %s %s %s %d %d %d %.3f\n", i, rec.ndx, rule_name[rule], rec.killed ? "kill" : "keep",
+                  rec.channel == HWF_APD ? "apd" : (rec.channel == HWF_PMT ? "pmt" : "-"), rec.bin, rec.run, rec.count, rec.slope);
+
+          rule_count[rule][rec.killed ? 1 : 0]++;
+        }
+    }
+
+  fclose (fp);
+
+
+  printf ("#\n# rule        kept      killed\n");
+
+  for (int32_t i = 1 ; i < HWF_RULES ; i++)
+    printf ("# %-10s %10" PRId64 " %10" PRId64 "\n", rule_name[i], rule_count[i][0], rule_count[i][1]);
+
+
+  return (NVTrue);
+}
@@ -0,0 +1,205 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  Relative costs for the work model in tune_band.  Looking up a cell (binary search on the occupied cells), checking whether
+//  a cell is in reach of a point (and walking its line groups), and testing one point against another.  These were fit to
+//  timings of the proximity passes on sparse and dense point clouds, only the ratios matter.
+
+#define HWF_COST_LOOKUP      50.0
+#define HWF_COST_CELL        18.0
+#define HWF_COST_POINT        1.0
+
+
+//  Don't bother starting another worker thread for less than this many points.  The proximity passes are split into about
+//  HWF_TASKS_PER_THREAD tasks per thread (but no fewer than HWF_MIN_TASK_POINTS points each) so that there is something left
+//  to steal when one thread gets the dense part of the band (see run_pool).
+
+#define HWF_THREAD_POINTS    10000
+#define HWF_TASKS_PER_THREAD 16
+#define HWF_MIN_TASK_POINTS  256
+
+
+
+/*  Average number of cell rows (or columns) in the stencil of a cell (see stencil_cells) for a given split and reach.  */
+
+static double stencil_width (int32_t split, int32_t reach)
+{
+  double sum = 0.0;
+
+  for (int32_t j = 0 ; j < split ; j++) sum += (double) (qMin (2 * split - 1, j + reach) - qMax (-split, j - reach) + 1);
+
+  return (sum / (double) split);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        tune_band                                           *
+*                                                                           *
+*   Purpose:            Pick the search bin split, the number of worker     *
+*                       threads, and the task size for a band from the      *
+*                       point density.  The split is the one with the least *
+*                       predicted proximity search work.  Finer cells let   *
+*                       the searches skip more of the 9 bin block but cost  *
+*                       more cell lookups and cell checks.  The predicted   *
+*                       work only depends on the number of points, the      *
+*                       number of occupied search bins, the search radius,  *
+*                       and the horizontal errors so this is one quick pass *
+*                       through the band's points.  The choices are printed *
+*                       if --stats was used.                                *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       wave_data      - the per point data for the band    *
+*                       count          - number of entries in wave_data     *
+*                       progname       - program name for --stats output    *
+*                                                                           *
+*   Return Value:       int32_t        - the split for build_bin_grid       *
+*                                                                           *
+\***************************************************************************/
+
+int32_t tune_band (MISC *misc, WAVE_DATA *wave_data, int32_t count, char *progname)
+{
+  double search_bin_size = misc->abe_share->filterShare.search_radius * 2.0;
+  int32_t points = 0, occupied = 0, split = qMax (0, qMin (HWF_MAX_SPLIT, misc->cell_split));
+  double herr_sum = 0.0, herr_max = 0.0;
+
+
+  //  Count the occupied search bins with a small open addressing hash table (keys are stored plus one so that zero is empty).
+
+  int32_t size = 1024;
+
+  while (size < count * 2) size *= 2;
+
+  uint64_t *table = (uint64_t *) calloc (size, sizeof (uint64_t));
+
+
+  //  If we can't get the memory we'll just use the plain search bins.  The results are the same either way.
+
+  if (table == NULL)
+    {
+      if (!split) split = 1;
+    }
+  else
+    {
+      for (int32_t i = 0 ; i < count ; i++)
+        {
+          int32_t ndx = wave_data[i].ndx;
+
+          if (misc->data[ndx].type != PFM_CHARTS_HOF_DATA) continue;
+
+          points++;
+          herr_sum += misc->data[ndx].herr;
+          herr_max = qMax (herr_max, (double) misc->data[ndx].herr);
+
+          uint32_t row = (uint32_t) (wave_data[i].my / search_bin_size);
+          uint32_t col = (uint32_t) (wave_data[i].mx / search_bin_size);
+
+          uint64_t key = (((uint64_t) row << 32) | col) + 1;
+          uint32_t h = (uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+
+          while (table[h] && table[h] != key) h = (h + 1) & (size - 1);
+
+          if (!table[h])
+            {
+              table[h] = key;
+              occupied++;
+            }
+        }
+
+      free (table);
+    }
+
+
+  //  Predicted work for each split.  For split k the cells are search_bin_size / k on a side and the stencil around a cell is
+  //  whatever part of the 9 bin block is within reach (same as build_bin_grid).  Points are assumed to be spread evenly over the
+  //  occupied search bins.
+  //
+  //    lookups     -  occupied cells times the stencil size (stencil_cells is done once per cell)
+  //    cell checks -  points times the occupied cells in the stencil (cell_in_reach)
+  //    point tests -  points times the points in the cells that are in reach of an average point
+
+  double work[HWF_MAX_SPLIT + 1];
+
+  for (int32_t k = 0 ; k <= HWF_MAX_SPLIT ; k++) work[k] = 0.0;
+
+  if (points && occupied)
+    {
+      double radius = misc->abe_share->filterShare.search_radius;
+      double reach_avg = radius + 2.0 * herr_sum / (double) points;
+      double reach_max = (radius + 2.0 * herr_max) * HWF_MASK_SCALE + search_bin_size * HWF_MASK_SLACK;
+
+      for (int32_t k = 1 ; k <= HWF_MAX_SPLIT ; k++)
+        {
+          double cell = search_bin_size / (double) k;
+          int32_t reach = qMin (3 * k, (int32_t) (reach_max / cell) + 2);
+          double width = stencil_width (k, reach);
+          double stencil = width * width;
+          double cells = qMin ((double) points, (double) occupied * k * k);
+          double fill = cells / ((double) occupied * k * k);
+          double in_reach = qMin (stencil, (2.0 * reach_avg / cell + 1.0) * (2.0 * reach_avg / cell + 1.0));
+          double per_cell = (double) points / ((double) occupied * k * k);
+
+          work[k] = cells * stencil * HWF_COST_LOOKUP + (double) points * stencil * fill * HWF_COST_CELL +
+            (double) points * in_reach * per_cell * HWF_COST_POINT;
+        }
+
+      if (!split)
+        {
+          split = 1;
+
+          for (int32_t k = 2 ; k <= HWF_MAX_SPLIT ; k++) if (work[k] < work[split]) split = k;
+        }
+    }
+  else if (!split)
+    {
+      split = 1;
+    }
+
+
+  //  Threads and tasks.  Unless --threads was used we don't start more threads than the band has work for.
+
+  misc->band_threads = misc->threads;
+
+  if (misc->auto_threads) misc->band_threads = qMax (1, qMin (misc->threads, points / HWF_THREAD_POINTS));
+
+  misc->task_points = qMax (HWF_MIN_TASK_POINTS, points / (misc->band_threads * HWF_TASKS_PER_THREAD));
+
+  misc->split_bands[split]++;
+
+
+  if (misc->stats)
+    {
+      fprintf (stderr, "%s - tune band %d: %d points in %d bins, split %d", progname, misc->bands, points, occupied, split);
+
+      if (work[1] > 0.0) fprintf (stderr, " (predicted work %.3g, %.3g unsplit)", work[split], work[1]);
+
+      fprintf (stderr, ", %d threads, %d point tasks\n", misc->band_threads, misc->task_points);
+    }
+
+
+  return (split);
+}
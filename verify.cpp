@@ -0,0 +1,447 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "hofWaveFilter.hpp"
+
+
+static const char *rule_text[HWF_RULES] = {"no rule", "AC offset", "surface", "run", "slope", "one line", "isolation", "no rise", "rise"};
+
+
+/*  Small repeatable random number generator for the synthetic point clouds (so the same seed gives the same cloud
+    everywhere).  */
+
+static uint32_t next_random (uint32_t *state)
+{
+  *state = *state * 1664525u + 1013904223u;
+
+  return (*state >> 8);
+}
+
+static double uniform (uint32_t *state)
+{
+  return ((double) next_random (state) / 16777216.0);
+}
+
+
+/*  Hash of a file and record number so that both returns of a shot get the same HOF and INH record.  */
+
+static uint32_t shot_hash (uint32_t file, uint32_t rec, uint32_t salt)
+{
+  uint32_t h = file * 2654435761u ^ (rec + 0x9e3779b9u) * 40503u ^ salt * 2246822519u;
+
+  h ^= h >> 15;
+  h *= 2246822519u;
+  h ^= h >> 13;
+  h *= 3266489917u;
+  h ^= h >> 16;
+
+  return (h);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        synthetic_cloud                                     *
+*                                                                           *
+*   Purpose:            Make up a point cloud for --verify_synthetic.  A    *
+*                       few crossing lines over a sloping bottom with some  *
+*                       fliers, invalid points, second returns, shallow     *
+*                       water/land codes, and non-HOF points.  Each shot    *
+*                       gets a waveform with a surface return and bottom    *
+*                       returns of random strength at its bottom bins.      *
+*                       The seed also varies the search radius, the         *
+*                       horizontal errors, and the AC zero offset           *
+*                       requirements.                                       *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       seed           - random number seed                 *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on memory error            *
+*                                                                           *
+\***************************************************************************/
+
+static uint8_t synthetic_cloud (MISC *misc, int32_t seed)
+{
+  uint32_t state = (uint32_t) seed;
+  int32_t lines = 2 + seed % 9;
+  int32_t shots = 300 + ((seed % 1000) * 7919) % 2700;
+  uint8_t non_hof = (seed % 5 == 4);
+
+
+  misc->abe_share = (ABE_SHARE *) calloc (1, sizeof (ABE_SHARE));
+  misc->data = (POINT_CLOUD *) malloc (lines * shots * 2 * sizeof (POINT_CLOUD));
+  misc->synthetic = (SYNTHETIC_SHOT *) malloc (lines * shots * 2 * sizeof (SYNTHETIC_SHOT));
+  if (misc->abe_share == NULL || misc->data == NULL || misc->synthetic == NULL)
+    {
+      perror ("Allocating synthetic point cloud in verify.cpp");
+      return (NVFalse);
+    }
+
+
+  //  About 450 meters on a side.
+
+  ABE_SHARE *abe = misc->abe_share;
+
+  abe->pfm_count = 0;
+  abe->edit_area.min_x = -76.0;
+  abe->edit_area.max_x = -75.996;
+  abe->edit_area.min_y = 36.0;
+  abe->edit_area.max_y = 36.004;
+  abe->filterShare.search_radius = (seed % 2) ? 1.0 + seed % 8 : 0.5 + (seed % 4) * 0.25;
+  abe->filterShare.search_width = 4 + seed % 8;
+  abe->filterShare.rise_threshold = 2 + seed % 4;
+  abe->filterShare.apd_ac_zero_offset_required = (seed % 3) ? 4 : 0;
+  abe->filterShare.pmt_ac_zero_offset_required = (seed % 2) ? 3 : 0;
+
+
+  int32_t count = 0;
+
+  for (int32_t l = 0 ; l < lines ; l++)
+    {
+      double angle = uniform (&state) * M_PI;
+      double cx = 0.2 + 0.6 * uniform (&state), cy = 0.2 + 0.6 * uniform (&state);
+
+      for (int32_t p = 0 ; p < shots ; p++)
+        {
+          double t = ((double) p / (double) shots - 0.5) * 1.2, w = (uniform (&state) - 0.5) * 0.15;
+          double fx = cx + t * cos (angle) - w * sin (angle), fy = cy + t * sin (angle) + w * cos (angle);
+
+          if (fx < 0.0 || fx > 0.999 || fy < 0.0 || fy > 0.999) continue;
+
+          POINT_CLOUD *point = &misc->data[count];
+
+          memset (point, 0, sizeof (POINT_CLOUD));
+          point->x = abe->edit_area.min_x + fx * (abe->edit_area.max_x - abe->edit_area.min_x);
+          point->y = abe->edit_area.min_y + fy * (abe->edit_area.max_y - abe->edit_area.min_y);
+          point->z = 10.0 + 3.0 * fx + ((uniform (&state) < 0.1) ? (uniform (&state) - 0.5) * 6.0 : (uniform (&state) - 0.5) * 0.3);
+          point->herr = 0.3 + uniform (&state) * ((seed % 4 == 0) ? 4.0 : 1.0);
+          point->verr = 0.2 + uniform (&state) * 0.4;
+          point->val = (uniform (&state) < 0.05) ? PFM_INVAL : 0;
+          point->pfm = 0;
+          point->file = l + 1;
+          point->line = l + 1;
+          point->rec = p + 1;
+          point->sub = 0;
+          point->type = (non_hof && uniform (&state) < 0.05) ? 0 : PFM_CHARTS_HOF_DATA;
+          count++;
+
+
+          //  Some shots have a second return a little deeper.
+
+          if (uniform (&state) < 0.3)
+            {
+              misc->data[count] = *point;
+              misc->data[count].sub = 1;
+              misc->data[count].z += 1.0 + uniform (&state) * 3.0;
+              misc->data[count].val = (uniform (&state) < 0.05) ? PFM_INVAL : 0;
+              count++;
+            }
+        }
+    }
+
+
+  //  Make up the HOF and INH records.  They're the same for both returns of a shot so a second return (which always comes
+  //  right after its first return at this point) just gets a copy.
+
+  for (int32_t i = 0 ; i < count ; i++)
+    {
+      SYNTHETIC_SHOT *shot = &misc->synthetic[i];
+
+      if (misc->data[i].sub)
+        {
+          *shot = misc->synthetic[i - 1];
+          continue;
+        }
+
+      uint32_t h = shot_hash (misc->data[i].file, misc->data[i].rec, 1);
+      float z = misc->data[i].z;
+
+      shot->abdc = (h % 17 == 0) ? 72 : ((h % 23 == 0) ? 70 : 90);
+      shot->sec_abdc = (h % 19 == 0) ? 74 : 90;
+      shot->bot_bin_first = (h % 29 == 0) ? 15 + (h >> 8) % 150 : (int32_t) (z * 5.0) + (int32_t) ((h >> 8) % 5);
+      shot->bot_bin_second = qMin (shot->bot_bin_first + 5 + (int32_t) ((h >> 16) % 40), HWF_APD_SIZE - 2);
+      shot->bot_channel = (h >> 3) & 1;
+      shot->sec_bot_chan = (h >> 4) & 1;
+      shot->calc_bot_run_required[0] = 2 + (h >> 20) % 4;
+      shot->calc_bot_run_required[1] = 2 + (h >> 24) % 4;
+      shot->apd_ac_zero_offset = 10 + APD;
+      shot->pmt_ac_zero_offset = 10 + PMT;
+
+      uint32_t s = shot_hash (misc->data[i].file, misc->data[i].rec, 2);
+      double amp = 20 + (s >> 8) % 120, width = 8 + (s >> 12) % 20;
+
+      for (int32_t ch = 0 ; ch < 2 ; ch++)
+        {
+          uint8_t *wave = ch ? shot->pmt : shot->apd;
+          int32_t size = ch ? HWF_PMT_SIZE : HWF_APD_SIZE;
+
+          for (int32_t j = 0 ; j < size ; j++)
+            {
+              double v = 12 + next_random (&s) % 2;
+
+              v += 180.0 * exp (-(j - 25) * (j - 25) / 18.0);
+              v += amp * exp (-(j - shot->bot_bin_first - 2) * (j - shot->bot_bin_first - 2) / width);
+              v += 0.6 * amp * exp (-(j - shot->bot_bin_second - 2) * (j - shot->bot_bin_second - 2) / width);
+
+              wave[j] = (uint8_t) qMin (v, 255.0);
+            }
+        }
+    }
+
+
+  //  Mix up the point order (pfmEdit hands us the points in bin order, not shot order).
+
+  for (int32_t i = count - 1 ; i > 0 ; i--)
+    {
+      int32_t j = (int32_t) (uniform (&state) * (i + 1));
+      POINT_CLOUD tmp = misc->data[i];
+      misc->data[i] = misc->data[j];
+      misc->data[j] = tmp;
+
+      SYNTHETIC_SHOT shot = misc->synthetic[i];
+      misc->synthetic[i] = misc->synthetic[j];
+      misc->synthetic[j] = shot;
+    }
+
+  abe->point_cloud_count = count;
+
+
+  init_geo_distance (2.0, abe->edit_area.min_x, abe->edit_area.min_y, abe->edit_area.max_x, abe->edit_area.max_y);
+
+
+  return (NVTrue);
+}
+
+
+
+static void free_synthetic_cloud (MISC *misc)
+{
+  if (misc->abe_share) free (misc->abe_share);
+  if (misc->data) free (misc->data);
+  if (misc->synthetic) free (misc->synthetic);
+
+  misc->abe_share = NULL;
+  misc->data = NULL;
+  misc->synthetic = NULL;
+}
+
+
+
+/*  The last rule in the trace for a point (0 if the point isn't in the trace).  */
+
+static TRACE_REC *last_trace (MISC *misc, int32_t ndx)
+{
+  for (int32_t t = 0 ; t < misc->trace_threads ; t++)
+    {
+      TRACE_RING *ring = &misc->trace[t];
+      int64_t first = qMax ((int64_t) 0, ring->total - HWF_TRACE_SIZE);
+
+      for (int64_t i = ring->total - 1 ; i >= first ; i--)
+        {
+          if (ring->rec[i & (HWF_TRACE_SIZE - 1)].ndx == ndx) return (&ring->rec[i & (HWF_TRACE_SIZE - 1)]);
+        }
+    }
+
+  return (NULL);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        verify_filter                                       *
+*                                                                           *
+*   Purpose:            Run the reference filter (reference_filter.cpp)     *
+*                       and the real one (with whatever options were given) *
+*                       on the same point cloud and compare the kill flags  *
+*                       point by point.  The first point that doesn't match *
+*                       is printed along with what each filter decided      *
+*                       about it.  The point cloud is left with the real    *
+*                       filter's results.                                   *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       int32_t        - number of points that don't match  *
+*                                        or -1 on error                     *
+*                                                                           *
+\***************************************************************************/
+
+int32_t verify_filter (MISC *misc, char *progname)
+{
+  int32_t count = misc->abe_share->point_cloud_count;
+  uint8_t own_trace = NVFalse, status = NVTrue;
+
+
+  //  Any failure falls through to the end so that everything we allocated gets freed.
+
+  uint8_t *original = (uint8_t *) malloc (qMax (count, 1));
+  uint8_t *reference = (uint8_t *) malloc (qMax (count, 1));
+  uint8_t *rule = (uint8_t *) malloc (qMax (count, 1));
+  if (original == NULL || reference == NULL || rule == NULL)
+    {
+      perror ("Allocating verify memory in verify.cpp");
+      status = NVFalse;
+    }
+
+  if (status)
+    {
+      for (int32_t i = 0 ; i < count ; i++) original[i] = misc->data[i].exflag;
+
+      status = reference_filter (misc, rule, progname);
+    }
+
+  if (status)
+    {
+      for (int32_t i = 0 ; i < count ; i++)
+        {
+          reference[i] = misc->data[i].exflag;
+          misc->data[i].exflag = original[i];
+        }
+
+
+      //  We need the trace to say why the real filter did what it did.
+
+      if (!misc->trace)
+        {
+          status = trace_init (misc, misc->threads);
+          own_trace = status;
+        }
+    }
+
+  if (status) status = filter_area (misc, progname);
+
+
+  int32_t mismatch = -1, first = -1;
+
+  if (status)
+    {
+      mismatch = 0;
+
+      for (int32_t i = 0 ; i < count ; i++)
+        {
+          if ((misc->data[i].exflag ? 1 : 0) != (reference[i] ? 1 : 0))
+            {
+              if (first < 0) first = i;
+              mismatch++;
+            }
+        }
+    }
+
+
+  if (first >= 0)
+    {
+      POINT_CLOUD *point = &misc->data[first];
+      TRACE_REC *trace = last_trace (misc, first);
+
+      fprintf (stderr, "%s - verify: %d of %d points don't match the reference filter\n", progname, mismatch, count);
+      fprintf (stderr, "%s - first mismatch is point %d (pfm %d, file %d, line %d, record %d, return %d, type %d, validity %x)\n", progname,
+               first, point->pfm, point->file, point->line, point->rec, point->sub, point->type, point->val);
+      fprintf (stderr, "%s - position %.9f %.9f, Z %.3f, horizontal error %.3f, vertical error %.3f\n", progname, point->y, point->x,
+               point->z, point->herr, point->verr);
+      fprintf (stderr, "%s - reference: %s (%s)\n", progname, reference[first] ? "killed" : "kept", rule_text[rule[first]]);
+
+      if (trace)
+        {
+          fprintf (stderr, "%s - filter:    %s (%s, channel %s, bin %d, run %d, neighbors %d, slope %.3f)\n", progname,
+                   point->exflag ? "killed" : "kept", rule_text[trace->rule < HWF_RULES ? trace->rule : 0],
+                   trace->channel == HWF_APD ? "APD" : (trace->channel == HWF_PMT ? "PMT" : "-"), trace->bin, trace->run, trace->count,
+                   trace->slope);
+        }
+      else
+        {
+          fprintf (stderr, "%s - filter:    %s (not in the trace)\n", progname, point->exflag ? "killed" : "kept");
+        }
+    }
+
+
+  if (own_trace) trace_free (misc);
+
+  if (original) free (original);
+  if (reference) free (reference);
+  if (rule) free (rule);
+
+
+  return (mismatch);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        verify_synthetic                                    *
+*                                                                           *
+*   Purpose:            Run verify_filter on synthetic point clouds made    *
+*                       with seeds 1 through cases.  This doesn't need      *
+*                       pfmEdit, PFM files, or HOF/INH files.               *
+*                       The waveform packing check is run first.            *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure (options set)   *
+*                       cases          - number of point clouds             *
+*                       progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVTrue if every case matched       *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t verify_synthetic (MISC *misc, int32_t cases, char *progname)
+{
+  int32_t failed = 0;
+
+
+  //  The compressed waveform pool has to get back what it was given before anything else is worth checking.
+
+  if (!check_waveform_packing (progname))
+    {
+      fprintf (stderr, "%s - waveform packing check failed\n", progname);
+      return (NVFalse);
+    }
+
+
+  for (int32_t seed = 1 ; seed <= cases ; seed++)
+    {
+      if (!synthetic_cloud (misc, seed))
+        {
+          free_synthetic_cloud (misc);
+          return (NVFalse);
+        }
+
+      int32_t mismatch = verify_filter (misc, progname);
+
+      fprintf (stderr, "%s - synthetic case %d: %d points, search radius %.2f - %s\n", progname, seed, misc->abe_share->point_cloud_count,
+               misc->abe_share->filterShare.search_radius, mismatch ? (mismatch < 0 ? "ERROR" : "MISMATCH") : "ok");
+
+      if (mismatch) failed++;
+
+      free_synthetic_cloud (misc);
+
+      if (mismatch < 0) break;
+    }
+
+  fprintf (stderr, "%s - %d of %d synthetic cases failed\n", progname, failed, cases);
+
+
+  return (failed == 0);
+}
@@ -38,7 +38,7 @@
 
 #ifndef VERSION
 
-#define     VERSION     "PFM Software - hofWaveFilter V1.19 - 06/23/17"
+#define     VERSION     "PFM Software - hofWaveFilter V2.00 - 10/18/26"
 
 #endif
 
@@ -151,4 +151,80 @@
 
     - Fixed bug caused by not initializing point memory area.
 
+
+    Version 2.00
+    PFM Software
+    10/18/26
+
+    - Waveforms are no longer kept in memory for every point.  The return filters look at each waveform as it is read
+      and the waveform check only reads the waveforms of the cross-line neighbors of the isolated points after the
+      proximity search is done.
+    - Non-HOF points are no longer put in the proximity search bins.
+    - Only the occupied proximity search bins are stored (and walked).  Memory and search time no longer depend on the
+      size of the edit area.
+    - The points in each proximity search bin are grouped by line so that same line points are skipped without
+      looking at them.
+    - The proximity passes work on compact columns (position, Z, errors, line, flags) copied out of the point cloud
+      in bin order instead of on the shared memory POINT_CLOUD records.
+    - Added --stats option to print stage times and counts.
+    - The proximity search bins (and the point columns and waveform pool) are in Morton order.
+    - The proximity passes run a single precision distance prefilter (AVX2 when the CPU has it) over 32 points of a
+      line at a time and only do the full double precision tests on the points that pass it.
+    - Added --compress_waveforms option to keep the waveform pool delta/run length coded in 64 sample blocks.  Only
+      the blocks under the waveform check search window are decoded (through a small decoded block cache).  A block
+      that would pack bigger than its raw differences is stored raw so a block never takes more than 65 bytes
+      (--verify_synthetic checks this).
+    - Split the proximity search and waveform check out into filter_band.cpp and the HOF read and return filter into
+      ingest_points.cpp.
+    - Added --memory_budget option to do the area in bands of bin rows (with two extra rows of bins on either side)
+      instead of all at once.  Only the band is held in memory and the results are the same.
+    - Added --trace option to record the rule that killed or kept each point (and its run, slope, rise count, and
+      neighbor count) in per thread ring buffers that are written to a file when done.  --decode_trace prints the file.
+    - Added --verify and --verify_synthetic options that run a copy of the original (unoptimized) filter alongside the
+      real one and report the first point where the kill flags differ.  --verify_synthetic makes up its own point clouds
+      so it can be run without pfmEdit or any data files.  The HOF/INH reads went into shot_io.cpp for this.
+    - The proximity search bins can be split into 2x2 up to 4x4 cells so that the searches skip the parts of the 9 bin
+      block that are out of reach.  The split (and the worker thread count and row tile size) is picked for each band
+      from a work estimate based on the point density (tune.cpp).  Added --cell_split and --threads options to override
+      the choices.  --stats prints them.
+    - The proximity passes run on a pool of worker threads (work_pool.cpp).  The bins are cut up into tasks (crowded
+      bins are split over several tasks) and a thread that runs out of tasks steals half of what's left from the
+      busiest thread.  --stats prints how long each thread was busy.
+    - The neighbor lists are sorted closest first and the waveform check reads the waveforms in two rounds.  The
+      first round only reads the two closest neighbors of each point, which decides most points.  The rest are only
+      read for the points that are still undecided.  Same results, far fewer waveforms read.
+    - The kills are kept in a bit set while filtering and copied to exflag at the end.  The waveform check tests the
+      neighbors against candidate, already killed, and loaded bit sets instead of the point cloud and WAVE_DATA.
+    - The return filters and the waveform pool take the APD/PMT waveforms straight out of the INH record (or the
+      synthetic shot) instead of a copy.
+    - Added read ahead of the HOF and INH records (shot_prefetch.cpp).  The next --io_depth records (default 32) in
+      the sorted read list are read into the page cache with io_uring (or posix_fadvise if io_uring isn't available)
+      before the CHARTS readers get to them.  --io_depth 0 turns it off.
+    - The surface (first drop) scan of the return filters was split out into find_first_drop.cpp and is only done once
+      per shot and channel.  The primary and secondary returns of a shot share it.
+    - The HOF and INH records of a shot are only read once when both of its returns are in the point cloud and the
+      two returns share one waveform pool slot.  --stats prints the number of records read.
+    - The per point arrays, the bin grid, and the candidate and neighbor lists are carved out of a memory arena
+      (arena.cpp) that is reset after each band and backed by huge pages where the system allows it (--huge_pages).
+      --stats prints the peak working memory.
+    - The return filters are run on batches of 32 returns per channel (return_filter_batch.cpp).  The first drop, run
+      start, and peak scans step all of the returns at once with AVX2 byte compares (when the CPU has it) and the rare
+      return that doesn't fit the batch scans is finished by the scalar filter, so the results are the same.
+    - Each proximity search cell keeps the line of its usable points when they're all from one line.  A point with no
+      usable point from another line anywhere in its stencil is left for the analyst without looking at its neighbors.
+    - The PFM/file/record sort of the points to read is an LSD radix sort on a packed 64 bit key (sort_records.cpp)
+      instead of qsort.  The old qsort compare function never returned a negative value.
+    - Added --sweep FILE to try many sets of filter settings (search radius and width, rise threshold, slope, and
+      AC zero offset checks) in one run (sweep.cpp).  The HOF and INH records are read once and each set is filtered
+      from memory.  What each set would kill goes to stdout and the point cloud isn't changed.
+    - Added --capture FILE to save the ABE settings the filter uses and the point cloud, and --replay FILE to run on
+      a capture without pfmEdit(3D) (capture.cpp).  The replay makes its own stand in shared memory so a real editing
+      session can be timed and profiled over and over.
+    - Added --time_budget and --priority_area (filter_area.cpp).  The rows of the priority area are filtered first as
+      a preview, the area is done in bands, and the kills are copied into the point cloud after each band.  No new
+      bands are started once the time budget is used up and the band that's running is stopped part way.  With these
+      options the point cloud is only locked while the kills are copied in and ABE_SHARE.modcode has HWF_MODCODE_PARTIAL
+      set while partial results are up and when the run was cut short.  A run that isn't cut short gives the same results
+      as before.
+
 */
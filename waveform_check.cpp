@@ -23,16 +23,38 @@
 
 #include "hofWaveFilter.hpp"
 
-uint8_t waveform_check (MISC *misc, WAVE_DATA *wave_data, int32_t recnum)
+
+/*  Fill in the trace record for waveform_check.  */
+
+static uint8_t trace_check (TRACE_REC *trace, uint8_t rule, uint8_t channel, int32_t bin, int32_t rise_count, int32_t count, uint8_t killed)
+{
+  if (trace)
+    {
+      trace->rule = rule;
+      trace->killed = killed;
+      trace->channel = channel;
+      trace->bin = bin;
+      trace->run = rise_count;
+      trace->count = count;
+      trace->slope = 0.0;
+    }
+
+  return (killed);
+}
+
+
+uint8_t waveform_check (MISC *misc, WAVE_DATA *wave_data, int32_t recnum, TRACE_REC *trace)
 {
+  uint8_t buffer[HWF_PMT_SIZE];
   int32_t bin = wave_data[recnum].bot_bin_first;
+  int32_t best_rise = 0;
 
-  if (misc->data[recnum].sub) bin = wave_data[recnum].bot_bin_second;
+  if (misc->data[wave_data[recnum].ndx].sub) bin = wave_data[recnum].bot_bin_second;
 
 
   //  I'm not looking at surface data.
 
-  if (bin < 20) return (NVFalse);
+  if (bin < 20) return (trace_check (trace, HWF_RULE_SURFACE, HWF_NO_CHANNEL, bin, 0, misc->point_count, NVFalse));
 
 
   for (int32_t i = 0 ; i < misc->point_count ; i++)
@@ -42,43 +64,55 @@ uint8_t waveform_check (MISC *misc, WAVE_DATA *wave_data, int32_t recnum)
       int32_t end_apd_search = qMin (HWF_APD_SIZE - 1, bin + misc->abe_share->filterShare.search_width);
       int32_t end_pmt_search = qMin (HWF_PMT_SIZE - 1, bin + misc->abe_share->filterShare.search_width);
       int32_t rise_count = 0;
-      int32_t ndx = misc->points[i];
+      int32_t slot = wave_data[misc->points[i]].wave;
 
       if (start_apd_search < HWF_APD_SIZE - 20)
         {
+          uint8_t *apd = waveform_samples (misc, slot, HWF_APD, start_apd_search - 1, end_apd_search - 1, buffer);
+
           for (int32_t j = start_apd_search ; j < end_apd_search ; j++)
             {
-              if (wave_data[ndx].apd[j] - wave_data[ndx].apd[j - 1] > 0)
+              if (apd[j] - apd[j - 1] > 0)
                 {
                   rise_count++;
                 }
-              else if (wave_data[ndx].apd[j] - wave_data[ndx].apd[j - 1] < 0)
+              else if (apd[j] - apd[j - 1] < 0)
                 {
                   rise_count = 0;
                 }
 
-              if (rise_count >= misc->abe_share->filterShare.rise_threshold) return (NVFalse);
+              if (rise_count >= misc->abe_share->filterShare.rise_threshold)
+                return (trace_check (trace, HWF_RULE_RISE, HWF_APD, bin, rise_count, misc->point_count, NVFalse));
             }
+
+          best_rise = qMax (best_rise, rise_count);
         }
 
 
       rise_count = 0;
 
+      uint8_t *pmt = waveform_samples (misc, slot, HWF_PMT, start_pmt_search - 1, end_pmt_search - 1, buffer);
+
       for (int32_t j = start_pmt_search ; j < end_pmt_search ; j++)
         {
-          if (wave_data[ndx].pmt[j] - wave_data[ndx].pmt[j - 1] > 0)
+          if (pmt[j] - pmt[j - 1] > 0)
             {
               rise_count++;
             }
-          else if (wave_data[ndx].pmt[j] - wave_data[ndx].pmt[j - 1] < 0)
+          else if (pmt[j] - pmt[j - 1] < 0)
             {
               rise_count = 0;
             }
 
-          if (rise_count >= misc->abe_share->filterShare.rise_threshold) return (NVFalse);
+          if (rise_count >= misc->abe_share->filterShare.rise_threshold)
+            return (trace_check (trace, HWF_RULE_RISE, HWF_PMT, bin, rise_count, misc->point_count, NVFalse));
         }
+
+      best_rise = qMax (best_rise, rise_count);
     }
 
 
-  return (NVTrue);
+  //  Nothing rose far enough.  For the trace the run is the longest rise left at the end of a search window.
+
+  return (trace_check (trace, HWF_RULE_NO_RISE, HWF_NO_CHANNEL, bin, best_rise, misc->point_count, NVTrue));
 }
@@ -0,0 +1,432 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+/*
+
+    Packed block format:
+
+    The first byte is the first sample of the block.  The rest of the block is stored as the differences between
+    adjacent samples (modulo 256) in runs.  The top two bits of the byte at the start of each run tell us what kind of
+    run it is and the low six bits are the run length minus one (1 to 64 differences):
+
+        00 - run of zero differences (no data follows)
+        01 - differences that are between -8 and 7, packed two to a byte (low nibble first)
+        10 - differences stored as is, one byte each
+
+    Lidar waveforms are pretty smooth so most of a block ends up in zero or nibble runs.  Mixing runs can cost more
+    than storing the differences as is though (small, small, big repeated is a two difference nibble run and a one
+    difference byte run, 4 bytes for every 3 differences), so if the packed block would be bigger than the first
+    sample plus one byte run of all the differences (HWF_BLOCK_SIZE + 1 bytes for a full block) that's what we store
+    instead.  A block has at most HWF_BLOCK_SIZE - 1 differences so it always fits in one byte run.  That makes
+    HWF_BLOCK_SIZE + 1 (65) bytes the most a block can take.
+
+*/
+
+#define RUN_ZERO    0x00
+#define RUN_NIBBLE  0x40
+#define RUN_BYTE    0x80
+
+
+static inline uint8_t small_diff (uint8_t diff)
+{
+  int32_t d = (int8_t) diff;
+
+  return (d >= -8 && d <= 7);
+}
+
+
+/*  Pack one block of samples into out (which must have room for count + 1 bytes).  Returns the packed length.  */
+
+static int32_t pack_block (uint8_t *sample, int32_t count, uint8_t *out)
+{
+  uint8_t diff[HWF_BLOCK_SIZE], packed[1 + 2 * HWF_BLOCK_SIZE];
+  int32_t len = 0;
+
+  packed[len++] = sample[0];
+
+  int32_t n = count - 1;
+  for (int32_t i = 0 ; i < n ; i++) diff[i] = (uint8_t) (sample[i + 1] - sample[i]);
+
+
+  int32_t i = 0;
+
+  while (i < n)
+    {
+      //  Zero runs of three or more.
+
+      int32_t run = 0;
+      while (i + run < n && !diff[i + run]) run++;
+
+      if (run >= 3)
+        {
+          packed[len++] = RUN_ZERO | (run - 1);
+          i += run;
+          continue;
+        }
+
+
+      //  Small differences (stop if a long zero run starts).
+
+      run = 0;
+      while (i + run < n && small_diff (diff[i + run]))
+        {
+          if (run && i + run + 3 <= n && !diff[i + run] && !diff[i + run + 1] && !diff[i + run + 2]) break;
+          run++;
+        }
+
+      if (run >= 2)
+        {
+          packed[len++] = RUN_NIBBLE | (run - 1);
+
+          for (int32_t j = 0 ; j < run ; j += 2)
+            {
+              uint8_t byte = diff[i + j] & 0x0f;
+              if (j + 1 < run) byte |= (diff[i + j + 1] & 0x0f) << 4;
+              packed[len++] = byte;
+            }
+
+          i += run;
+          continue;
+        }
+
+
+      //  Anything else goes in as is (until two small differences in a row show up).
+
+      run = 1;
+      while (i + run < n && !(i + run + 1 < n && small_diff (diff[i + run]) && small_diff (diff[i + run + 1]))) run++;
+
+      packed[len++] = RUN_BYTE | (run - 1);
+      memcpy (&packed[len], &diff[i], run);
+      len += run;
+      i += run;
+    }
+
+
+  //  Too big, just store the differences (see the format notes above).
+
+  if (len > count + 1)
+    {
+      len = 0;
+      out[len++] = sample[0];
+
+      if (n)
+        {
+          out[len++] = RUN_BYTE | (n - 1);
+          memcpy (&out[len], diff, n);
+          len += n;
+        }
+
+      return (len);
+    }
+
+  memcpy (out, packed, len);
+
+
+  return (len);
+}
+
+
+/*  Unpack one block.  */
+
+static void unpack_block (uint8_t *in, int32_t count, uint8_t *sample)
+{
+  int32_t len = 0, i = 1;
+
+  sample[0] = in[len++];
+
+  while (i < count)
+    {
+      uint8_t tag = in[len++];
+      int32_t run = (tag & 0x3f) + 1;
+
+      switch (tag & 0xc0)
+        {
+        case RUN_ZERO:
+          for (int32_t j = 0 ; j < run ; j++, i++) sample[i] = sample[i - 1];
+          break;
+
+        case RUN_NIBBLE:
+          for (int32_t j = 0 ; j < run ; j++, i++)
+            {
+              int32_t nibble = (j & 1) ? (in[len + j / 2] >> 4) : (in[len + j / 2] & 0x0f);
+              sample[i] = (uint8_t) (sample[i - 1] + ((nibble ^ 0x08) - 0x08));
+            }
+          len += (run + 1) / 2;
+          break;
+
+        default:
+          for (int32_t j = 0 ; j < run ; j++, i++) sample[i] = (uint8_t) (sample[i - 1] + in[len + j]);
+          len += run;
+          break;
+        }
+    }
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        pack_waveform                                       *
+*                                                                           *
+*   Purpose:            Compress a waveform into the packed waveform pool.  *
+*                       misc->packed must have room for the slot.  The      *
+*                       first call allocates the decoded block cache.       *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       slot           - waveform pool slot                 *
+*                       apd            - APD samples                        *
+*                       pmt            - PMT samples                        *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on memory error            *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t pack_waveform (MISC *misc, int32_t slot, uint8_t *apd, uint8_t *pmt)
+{
+  if (misc->block_cache == NULL)
+    {
+      misc->block_cache = (WAVE_BLOCK *) malloc (HWF_CACHE_SIZE * sizeof (WAVE_BLOCK));
+      if (misc->block_cache == NULL)
+        {
+          perror ("Allocating decoded block cache in waveform_pool.cpp");
+          return (NVFalse);
+        }
+
+      for (int32_t i = 0 ; i < HWF_CACHE_SIZE ; i++) misc->block_cache[i].key = -1;
+    }
+
+
+  //  Make sure there's room for the worst case (HWF_BLOCK_SIZE + 1 bytes per block, see pack_block).
+
+  int64_t worst = HWF_WAVE_BLOCKS * (HWF_BLOCK_SIZE + 1);
+
+  if (misc->packed_size + worst > misc->packed_alloc)
+    {
+      misc->packed_alloc = qMax ((int64_t) 1048576, qMax (misc->packed_alloc * 2, misc->packed_size + worst));
+
+      if ((misc->packed_data = (uint8_t *) realloc (misc->packed_data, misc->packed_alloc)) == NULL)
+        {
+          perror ("Allocating packed waveform memory in waveform_pool.cpp");
+          return (NVFalse);
+        }
+    }
+
+
+  PACKED_WAVEFORM *packed = &misc->packed[slot];
+
+  packed->offset = misc->packed_size;
+
+  for (int32_t b = 0 ; b < HWF_WAVE_BLOCKS ; b++)
+    {
+      uint8_t *sample;
+      int32_t count;
+
+      if (b < HWF_APD_BLOCKS)
+        {
+          sample = &apd[b * HWF_BLOCK_SIZE];
+          count = qMin (HWF_BLOCK_SIZE, HWF_APD_SIZE - b * HWF_BLOCK_SIZE);
+        }
+      else
+        {
+          sample = &pmt[(b - HWF_APD_BLOCKS) * HWF_BLOCK_SIZE];
+          count = qMin (HWF_BLOCK_SIZE, HWF_PMT_SIZE - (b - HWF_APD_BLOCKS) * HWF_BLOCK_SIZE);
+        }
+
+      int32_t len = pack_block (sample, count, &misc->packed_data[misc->packed_size]);
+
+      packed->length[b] = len;
+      misc->packed_size += len;
+    }
+
+
+  return (NVTrue);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        waveform_samples                                    *
+*                                                                           *
+*   Purpose:            Get samples first through last (inclusive) of the   *
+*                       APD or PMT waveform in a pool slot.  For an         *
+*                       uncompressed pool this is just a pointer into the   *
+*                       pool.  For a compressed pool the blocks that cover  *
+*                       the range are taken from the decoded block cache    *
+*                       (decoding them if they aren't there) and copied to  *
+*                       buffer.  At most (last - first) / HWF_BLOCK_SIZE +  *
+*                       2 blocks are decoded per call.  Nothing is copied   *
+*                       if last is before first (an empty search window).   *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       slot           - waveform pool slot                 *
+*                       type           - HWF_APD or HWF_PMT                 *
+*                       first          - first sample needed                *
+*                       last           - last sample needed                 *
+*                       buffer         - HWF_PMT_SIZE byte scratch buffer   *
+*                                                                           *
+*   Return Value:       uint8_t *      - array of samples (only first       *
+*                                        through last are valid for a       *
+*                                        compressed pool)                   *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t *waveform_samples (MISC *misc, int32_t slot, int32_t type, int32_t first, int32_t last, uint8_t *buffer)
+{
+  if (!misc->compress) return (type == HWF_APD ? misc->waveform[slot].apd : misc->waveform[slot].pmt);
+
+  if (first > last) return (buffer);
+
+
+  int32_t size = (type == HWF_APD) ? HWF_APD_SIZE : HWF_PMT_SIZE;
+  int32_t block0 = (type == HWF_APD) ? 0 : HWF_APD_BLOCKS;
+  PACKED_WAVEFORM *packed = &misc->packed[slot];
+
+  for (int32_t b = first / HWF_BLOCK_SIZE ; b <= last / HWF_BLOCK_SIZE ; b++)
+    {
+      int64_t key = (int64_t) slot * HWF_WAVE_BLOCKS + block0 + b;
+      WAVE_BLOCK *entry = &misc->block_cache[key & (HWF_CACHE_SIZE - 1)];
+      int32_t count = qMin (HWF_BLOCK_SIZE, size - b * HWF_BLOCK_SIZE);
+
+      misc->block_reads++;
+
+      if (entry->key != key)
+        {
+          int64_t offset = packed->offset;
+          for (int32_t i = 0 ; i < block0 + b ; i++) offset += packed->length[i];
+
+          unpack_block (&misc->packed_data[offset], count, entry->sample);
+          entry->key = key;
+          misc->block_decodes++;
+        }
+
+
+      //  Only copy the part of the block that we need.
+
+      int32_t start = qMax (first, b * HWF_BLOCK_SIZE);
+      int32_t end = qMin (last, b * HWF_BLOCK_SIZE + count - 1);
+
+      memcpy (&buffer[start], &entry->sample[start - b * HWF_BLOCK_SIZE], end - start + 1);
+    }
+
+
+  return (buffer);
+}
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        check_waveform_packing                              *
+*                                                                           *
+*   Purpose:            Run some nasty sample patterns through pack_block   *
+*                       and unpack_block and make sure every block comes    *
+*                       back unchanged and never packs to more than the     *
+*                       HWF_BLOCK_SIZE + 1 bytes that pack_waveform         *
+*                       reserves for it.  The small, small, big difference  *
+*                       pattern is the one that used to run over.  Done     *
+*                       by --verify_synthetic.                              *
+*                                                                           *
+*   Arguments:          progname       - program name for error messages    *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse if any block failed        *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t check_waveform_packing (char *progname)
+{
+  uint8_t sample[HWF_BLOCK_SIZE], out[HWF_BLOCK_SIZE], packed[1 + 2 * HWF_BLOCK_SIZE];
+  int32_t failed = 0;
+
+
+  //  Full blocks and the short last blocks of the APD and PMT waveforms.
+
+  int32_t counts[3] = {HWF_BLOCK_SIZE, HWF_APD_SIZE % HWF_BLOCK_SIZE, HWF_PMT_SIZE % HWF_BLOCK_SIZE};
+
+  for (int32_t c = 0 ; c < 3 ; c++)
+    {
+      int32_t count = counts[c];
+      if (!count) continue;
+
+      for (int32_t pattern = 0 ; pattern < 5 ; pattern++)
+        {
+          uint32_t seed = 12345 + pattern;
+
+          sample[0] = 20;
+
+          for (int32_t i = 1 ; i < count ; i++)
+            {
+              switch (pattern)
+                {
+                  //  Small, small, big (alternating nibble and byte runs).
+
+                case 0:
+                  sample[i] = (uint8_t) (sample[i - 1] + ((i % 3) ? 1 : 100));
+                  break;
+
+                  //  Same thing starting on the big one.
+
+                case 1:
+                  sample[i] = (uint8_t) (sample[i - 1] + ((i % 3 == 1) ? 100 : 1));
+                  break;
+
+                  //  Flat.
+
+                case 2:
+                  sample[i] = sample[i - 1];
+                  break;
+
+                  //  Ramp.
+
+                case 3:
+                  sample[i] = (uint8_t) (sample[i - 1] + 3);
+                  break;
+
+                  //  Noise.
+
+                default:
+                  seed = seed * 1103515245 + 12345;
+                  sample[i] = (uint8_t) (seed >> 16);
+                  break;
+                }
+            }
+
+
+          int32_t len = pack_block (sample, count, packed);
+          unpack_block (packed, count, out);
+
+          if (len > count + 1 || memcmp (sample, out, count))
+            {
+              fprintf (stderr, "%s: waveform pattern %d (%d samples) packed to %d bytes (%s)\n", progname, pattern, count, len,
+                       memcmp (sample, out, count) ? "didn't unpack" : "too big");
+              failed++;
+            }
+        }
+    }
+
+
+  return (failed == 0);
+}
@@ -0,0 +1,252 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "hofWaveFilter.hpp"
+
+
+//  Each thread has a queue of task numbers (first through last - 1).  A thread takes its own tasks from the front of its
+//  queue.  When it runs out it steals the back half of the fullest queue.  The tasks are handed out in order so the tasks
+//  in a queue are next to each other in the bin grid and the owner works through them in memory order.
+
+typedef struct
+{
+  QMutex      mutex;
+  int32_t     first;
+  int32_t     last;
+} TASK_QUEUE;
+
+
+typedef struct
+{
+  MISC        *misc;
+  TASK_QUEUE  *queue;
+  int32_t     threads;
+  POOL_TASK   task;
+  void        *data;
+} POOL;
+
+
+/*  Get the next task for a thread (-1 when there's nothing left anywhere).  */
+
+static int32_t next_task (POOL *pool, int32_t thread)
+{
+  TASK_QUEUE *own = &pool->queue[thread];
+  int32_t task = -1;
+
+
+  own->mutex.lock ();
+
+  if (own->first < own->last)
+    {
+      task = own->first;
+      own->first++;
+    }
+
+  own->mutex.unlock ();
+
+  if (task >= 0) return (task);
+
+
+  //  Out of work.  Find the queue with the most tasks left.  Another thread may get to it first so we keep looking until
+  //  all of the queues are empty.
+
+  while (NVTrue)
+    {
+      int32_t victim = -1, most = 0;
+
+      for (int32_t i = 0 ; i < pool->threads ; i++)
+        {
+          if (i == thread) continue;
+
+          pool->queue[i].mutex.lock ();
+          int32_t left = pool->queue[i].last - pool->queue[i].first;
+          pool->queue[i].mutex.unlock ();
+
+          if (left > most)
+            {
+              most = left;
+              victim = i;
+            }
+        }
+
+      if (victim < 0) return (-1);
+
+
+      //  Take the back half (rounded up so that a single task can be stolen).
+
+      TASK_QUEUE *other = &pool->queue[victim];
+      int32_t start = -1, end = -1;
+
+      other->mutex.lock ();
+
+      int32_t left = other->last - other->first;
+
+      if (left > 0)
+        {
+          end = other->last;
+          start = end - (left + 1) / 2;
+          other->last = start;
+        }
+
+      other->mutex.unlock ();
+
+      if (start < 0) continue;
+
+
+      //  Run the first one now and put the rest in our own queue.
+
+      own->mutex.lock ();
+      own->first = start + 1;
+      own->last = end;
+      own->mutex.unlock ();
+
+      pool->misc->steals[thread]++;
+
+      return (start);
+    }
+}
+
+
+/*  Run tasks until there aren't any left.  */
+
+static void pool_work (POOL *pool, int32_t thread)
+{
+  QElapsedTimer timer;
+  int32_t task;
+
+  timer.start ();
+
+  while ((task = next_task (pool, thread)) >= 0)
+    {
+      int64_t start = timer.nsecsElapsed ();
+
+      pool->task (pool->data, thread, task);
+
+      pool->misc->busy_ns[thread] += timer.nsecsElapsed () - start;
+      pool->misc->tasks[thread]++;
+    }
+}
+
+
+class poolThread : public QThread
+{
+public:
+
+  POOL        *pool;
+  int32_t     thread;
+
+
+protected:
+
+  void run ()
+  {
+    pool_work (pool, thread);
+  }
+};
+
+
+
+/***************************************************************************\
+*                                                                           *
+*   Module Name:        run_pool                                            *
+*                                                                           *
+*   Purpose:            Run task 0 through task_count - 1 on a pool of      *
+*                       threads and wait for them all to finish.  The tasks *
+*                       start out split evenly (in order) between the       *
+*                       threads and a thread that runs out of work steals   *
+*                       half of what's left from the busiest thread, so a   *
+*                       few slow tasks (dense bins) don't leave the other   *
+*                       threads sitting idle.  The calling thread is thread *
+*                       0.  The time each thread spends running tasks is    *
+*                       added to misc->busy_ns for --stats.                 *
+*                                                                           *
+*   Arguments:          misc           - the MISC structure                 *
+*                       threads        - number of threads (including the   *
+*                                        calling thread)                    *
+*                       task_count     - number of tasks                    *
+*                       task           - the task function                  *
+*                       data           - passed to the task function        *
+*                                                                           *
+*   Return Value:       uint8_t        - NVFalse on memory error            *
+*                                                                           *
+\***************************************************************************/
+
+uint8_t run_pool (MISC *misc, int32_t threads, int32_t task_count, POOL_TASK task, void *data)
+{
+  POOL pool;
+
+  threads = qMax (1, qMin (qMin (threads, HWF_MAX_THREADS), task_count));
+
+  pool.misc = misc;
+  pool.threads = threads;
+  pool.task = task;
+  pool.data = data;
+  pool.queue = new (std::nothrow) TASK_QUEUE[threads];
+  if (pool.queue == NULL)
+    {
+      perror ("Allocating task queues in work_pool.cpp");
+      return (NVFalse);
+    }
+
+  for (int32_t i = 0 ; i < threads ; i++)
+    {
+      pool.queue[i].first = (int32_t) ((int64_t) task_count * i / threads);
+      pool.queue[i].last = (int32_t) ((int64_t) task_count * (i + 1) / threads);
+    }
+
+
+  //  No point in starting threads if there's only one (this is also what happens with --threads 1).
+
+  if (threads == 1)
+    {
+      pool_work (&pool, 0);
+      delete[] pool.queue;
+      return (NVTrue);
+    }
+
+
+  poolThread *worker = new (std::nothrow) poolThread[threads - 1];
+  if (worker == NULL)
+    {
+      perror ("Allocating worker threads in work_pool.cpp");
+      delete[] pool.queue;
+      return (NVFalse);
+    }
+
+  for (int32_t i = 0 ; i < threads - 1 ; i++)
+    {
+      worker[i].pool = &pool;
+      worker[i].thread = i + 1;
+      worker[i].start ();
+    }
+
+  pool_work (&pool, 0);
+
+  for (int32_t i = 0 ; i < threads - 1 ; i++) worker[i].wait ();
+
+  delete[] worker;
+  delete[] pool.queue;
+
+
+  return (NVTrue);
+}